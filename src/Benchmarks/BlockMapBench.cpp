@@ -0,0 +1,136 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include <iostream>
+#include <chrono>
+#include <cmath>
+
+#include "../BlockMap.hpp"
+
+//Compares the block map kernels on terrain like the generator makes.
+namespace {
+	//How many times each measurement is repeated.
+	constexpr size_t repeats = 20;
+
+	/**
+	 * Creates stepped terrain out of 2x2 columns, so most bricks along the
+	 * surface are mixed.
+	 * @return The regions of the terrain.
+	 */
+	std::vector<InternalRegion> makeTerrain() {
+		std::vector<InternalRegion> regions;
+
+		for (size_t x = 0; x < 256; x += 2) {
+			for (size_t z = 0; z < 256; z += 2) {
+				uint8_t height = (uint8_t) (128.0 + 40.0 * std::sin(x / 23.0) * std::cos(z / 31.0));
+				regions.push_back({1, Aabb<uint8_t>({(uint8_t) x, 0, (uint8_t) z}, {(uint8_t) (x + 1), height, (uint8_t) (z + 1)})});
+			}
+		}
+
+		return regions;
+	}
+
+	/**
+	 * Times a function, run several times.
+	 * @param fn The function to time.
+	 * @return The average time taken, in milliseconds.
+	 */
+	template<typename Func>
+	double timeMillis(Func fn) {
+		auto start = std::chrono::steady_clock::now();
+
+		for (size_t i = 0; i < repeats; i++) {
+			fn();
+		}
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / repeats;
+	}
+
+	/**
+	 * Runs every measurement with the current kernels.
+	 * @param tree The terrain.
+	 * @param faces Set to the faces generated for the terrain.
+	 */
+	void runBenchmarks(const RegionTree& tree, std::vector<RegionFace>& faces) {
+		std::vector<InternalRegion> regions = makeTerrain();
+		std::unique_ptr<BlockMap> map = std::make_unique<BlockMap>();
+		size_t found = 0;
+
+		double fillTime = timeMillis([&]() {
+			map->clear();
+
+			for (const InternalRegion& reg : regions) {
+				map->addRegionFill(reg);
+			}
+		});
+
+		double checkTime = timeMillis([&]() {
+			for (const InternalRegion& reg : regions) {
+				//Checks the column and the air just above it
+				Aabb<uint8_t> above = reg.box;
+				above.min.y = std::min<int>(reg.box.max.y + 1, 255);
+				above.max.y = std::min<int>(reg.box.max.y + 8, 255);
+
+				found += map->isBoxFilled(reg.box);
+				found += map->isBoxEmpty(above);
+			}
+		});
+
+		double meshTime = timeMillis([&]() {
+			faces = tree.genQuads();
+		});
+
+		std::cout << BlockMap::getKernelName() << ": fill " << fillTime << "ms, check " << checkTime << "ms, mesh " <<
+			meshTime << "ms (" << faces.size() << " faces, " << found / repeats << " boxes matched)\n";
+	}
+
+	/**
+	 * Checks whether two face lists are the same.
+	 */
+	bool sameFaces(const std::vector<RegionFace>& first, const std::vector<RegionFace>& second) {
+		return std::equal(first.begin(), first.end(), second.begin(), second.end(), [](const RegionFace& a, const RegionFace& b) {
+			return a.normFixed == b.normFixed && a.min == b.min && a.max == b.max && a.type == b.type;
+		});
+	}
+}
+
+int main() {
+	RegionTree tree;
+	tree.addRegions(makeTerrain());
+
+	std::vector<RegionFace> scalarFaces;
+	std::vector<RegionFace> avx2Faces;
+
+	BlockMap::setKernels("Scalar");
+	runBenchmarks(tree, scalarFaces);
+
+	if (!BlockMap::setKernels("AVX2")) {
+		std::cout << "AVX2 kernels aren't supported here\n";
+		return 0;
+	}
+
+	runBenchmarks(tree, avx2Faces);
+
+	if (!sameFaces(scalarFaces, avx2Faces)) {
+		std::cout << "Kernels generated different faces!\n";
+		return 1;
+	}
+
+	return 0;
+}
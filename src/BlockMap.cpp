@@ -0,0 +1,182 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include "BlockMap.hpp"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define VOXEX_BLOCKMAP_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+	//Functions used for the rows of mixed bricks. Rows are stored x-major,
+	//so the 16 rows for one x position are 256 contiguous bits.
+	struct Kernels {
+		const char* name;
+		void (*fillRows)(uint16_t* payload, size_t minX, size_t maxX, size_t minY, size_t maxY, uint16_t mask);
+		bool (*areRowsFilled)(const uint16_t* payload, size_t minX, size_t maxX, size_t minY, size_t maxY, uint16_t mask);
+		bool (*areRowsEmpty)(const uint16_t* payload, size_t minX, size_t maxX, size_t minY, size_t maxY, uint16_t mask);
+	};
+
+	constexpr size_t brickLength = BlockMap::brickLength;
+
+	void fillRowsScalar(uint16_t* payload, size_t minX, size_t maxX, size_t minY, size_t maxY, uint16_t mask) {
+		for (size_t x = minX; x <= maxX; x++) {
+			for (size_t y = minY; y <= maxY; y++) {
+				payload[x * brickLength + y] |= mask;
+			}
+		}
+	}
+
+	bool areRowsFilledScalar(const uint16_t* payload, size_t minX, size_t maxX, size_t minY, size_t maxY, uint16_t mask) {
+		for (size_t x = minX; x <= maxX; x++) {
+			for (size_t y = minY; y <= maxY; y++) {
+				if ((payload[x * brickLength + y] & mask) != mask) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	bool areRowsEmptyScalar(const uint16_t* payload, size_t minX, size_t maxX, size_t minY, size_t maxY, uint16_t mask) {
+		for (size_t x = minX; x <= maxX; x++) {
+			for (size_t y = minY; y <= maxY; y++) {
+				if (payload[x * brickLength + y] & mask) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+#ifdef VOXEX_BLOCKMAP_AVX2
+	/**
+	 * Creates a vector with the mask in the lanes for the rows from minY
+	 * to maxY, and zero in the others.
+	 */
+	__attribute__((target("avx2")))
+	__m256i laneMask(size_t minY, size_t maxY, uint16_t mask) {
+		const __m256i lanes = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		__m256i aboveMin = _mm256_cmpgt_epi16(lanes, _mm256_set1_epi16((int16_t) minY - 1));
+		__m256i belowMax = _mm256_cmpgt_epi16(_mm256_set1_epi16((int16_t) maxY + 1), lanes);
+
+		return _mm256_and_si256(_mm256_and_si256(aboveMin, belowMax), _mm256_set1_epi16((int16_t) mask));
+	}
+
+	__attribute__((target("avx2")))
+	void fillRowsAvx2(uint16_t* payload, size_t minX, size_t maxX, size_t minY, size_t maxY, uint16_t mask) {
+		__m256i fill = laneMask(minY, maxY, mask);
+
+		for (size_t x = minX; x <= maxX; x++) {
+			__m256i* rows = (__m256i*) &payload[x * brickLength];
+			_mm256_storeu_si256(rows, _mm256_or_si256(_mm256_loadu_si256(rows), fill));
+		}
+	}
+
+	__attribute__((target("avx2")))
+	bool areRowsFilledAvx2(const uint16_t* payload, size_t minX, size_t maxX, size_t minY, size_t maxY, uint16_t mask) {
+		__m256i check = laneMask(minY, maxY, mask);
+
+		for (size_t x = minX; x <= maxX; x++) {
+			__m256i rows = _mm256_loadu_si256((const __m256i*) &payload[x * brickLength]);
+
+			//Set if every bit in check is also in rows
+			if (!_mm256_testc_si256(rows, check)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	__attribute__((target("avx2")))
+	bool areRowsEmptyAvx2(const uint16_t* payload, size_t minX, size_t maxX, size_t minY, size_t maxY, uint16_t mask) {
+		__m256i check = laneMask(minY, maxY, mask);
+
+		for (size_t x = minX; x <= maxX; x++) {
+			__m256i rows = _mm256_loadu_si256((const __m256i*) &payload[x * brickLength]);
+
+			//Set if no bit in check is in rows
+			if (!_mm256_testz_si256(rows, check)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+#endif
+
+	constexpr Kernels scalarKernels = {"Scalar", fillRowsScalar, areRowsFilledScalar, areRowsEmptyScalar};
+
+#ifdef VOXEX_BLOCKMAP_AVX2
+	constexpr Kernels avx2Kernels = {"AVX2", fillRowsAvx2, areRowsFilledAvx2, areRowsEmptyAvx2};
+#endif
+
+	Kernels chooseKernels() {
+#ifdef VOXEX_BLOCKMAP_AVX2
+		if (__builtin_cpu_supports("avx2")) {
+			return avx2Kernels;
+		}
+#endif
+
+		return scalarKernels;
+	}
+
+	Kernels& getKernels() {
+		static Kernels kernels = chooseKernels();
+		return kernels;
+	}
+}
+
+const char* BlockMap::getKernelName() {
+	return getKernels().name;
+}
+
+bool BlockMap::setKernels(const std::string& name) {
+	if (name == scalarKernels.name) {
+		getKernels() = scalarKernels;
+		return true;
+	}
+
+#ifdef VOXEX_BLOCKMAP_AVX2
+	if (name == avx2Kernels.name && __builtin_cpu_supports("avx2")) {
+		getKernels() = avx2Kernels;
+		return true;
+	}
+#endif
+
+	return false;
+}
+
+void BlockMap::fillRows(Payload& payload, const Aabb<uint8_t>& part, uint16_t mask) {
+	getKernels().fillRows(payload.data(), part.min.x & (brickLength - 1), part.max.x & (brickLength - 1),
+		part.min.y & (brickLength - 1), part.max.y & (brickLength - 1), mask);
+}
+
+bool BlockMap::areRowsFilled(const Payload& payload, const Aabb<uint8_t>& part, uint16_t mask) {
+	return getKernels().areRowsFilled(payload.data(), part.min.x & (brickLength - 1), part.max.x & (brickLength - 1),
+		part.min.y & (brickLength - 1), part.max.y & (brickLength - 1), mask);
+}
+
+bool BlockMap::areRowsEmpty(const Payload& payload, const Aabb<uint8_t>& part, uint16_t mask) {
+	return getKernels().areRowsEmpty(payload.data(), part.min.x & (brickLength - 1), part.max.x & (brickLength - 1),
+		part.min.y & (brickLength - 1), part.max.y & (brickLength - 1), mask);
+}
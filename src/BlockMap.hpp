@@ -18,25 +18,171 @@
 
 #pragma once
 
-#include <bitset>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
 
 #include "RegionTree.hpp"
 
+/**
+ * Stores which blocks are filled in one 256x256 layer on the side of a
+ * chunk, so neighboring chunks can check whether faces on their edge are
+ * covered. Positions use the same two axes as a RegionFace with the
+ * normal of that side.
+ */
+class BoundaryPlane {
+public:
+	static constexpr size_t length = 256;
+
+	/**
+	 * Creates a plane with every block empty.
+	 */
+	BoundaryPlane() : bits{} {}
+
+	/**
+	 * Sets the blocks in a rectangle as filled.
+	 * @param min The minimum corner.
+	 * @param max The maximum corner, exclusive.
+	 */
+	void fillRect(const std::array<uint16_t, 2>& min, const std::array<uint16_t, 2>& max) {
+		for (size_t u = min.at(0); u < max.at(0); u++) {
+			for (size_t v = min.at(1); v < max.at(1); v++) {
+				bits[index(u, v)] |= bit(v);
+			}
+		}
+	}
+
+	/**
+	 * Gets whether the block at the given position is filled.
+	 * @param u,v The position to check.
+	 * @return Whether the block is filled.
+	 */
+	bool isFilled(size_t u, size_t v) const {
+		return bits[index(u, v)] & bit(v);
+	}
+
+	/**
+	 * Checks whether every block in a rectangle is filled.
+	 * @param min The minimum corner.
+	 * @param max The maximum corner, exclusive.
+	 * @return Whether the whole rectangle is filled.
+	 */
+	bool isRectFilled(const std::array<uint16_t, 2>& min, const std::array<uint16_t, 2>& max) const {
+		for (size_t u = min.at(0); u < max.at(0); u++) {
+			for (size_t v = min.at(1); v < max.at(1); v++) {
+				if (!isFilled(u, v)) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Checks whether every block in a rectangle is empty.
+	 * @param min The minimum corner.
+	 * @param max The maximum corner, exclusive.
+	 * @return Whether the whole rectangle is empty.
+	 */
+	bool isRectEmpty(const std::array<uint16_t, 2>& min, const std::array<uint16_t, 2>& max) const {
+		for (size_t u = min.at(0); u < max.at(0); u++) {
+			for (size_t v = min.at(1); v < max.at(1); v++) {
+				if (isFilled(u, v)) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Checks whether every block in the plane is filled.
+	 * @return Whether the plane is full.
+	 */
+	bool isFull() const {
+		return std::all_of(bits.begin(), bits.end(), [](uint64_t word) { return word == ~0ul; });
+	}
+
+	/**
+	 * Checks whether every block in the plane is empty.
+	 * @return Whether the plane is empty.
+	 */
+	bool isEmpty() const {
+		return std::all_of(bits.begin(), bits.end(), [](uint64_t word) { return word == 0; });
+	}
+
+private:
+	//One row of 256 bits for each u position.
+	std::array<uint64_t, length * length / 64> bits;
+
+	static size_t index(size_t u, size_t v) { return u * (length / 64) + (v >> 6); }
+	static uint64_t bit(size_t v) { return 1ul << (v & 63); }
+};
+
+/**
+ * Stores which blocks in a chunk are filled. The chunk is split into bricks
+ * of 16x16x16 blocks, which are either completely empty, completely full,
+ * or mixed. Only mixed bricks store a bit for every block, so filling large
+ * regions and checking faces against them costs about the same as with
+ * small ones, and most of a chunk never needs to be touched.
+ */
 class BlockMap {
 public:
 	static constexpr size_t length = 256;
 	static constexpr size_t area = length * length;
 	static constexpr size_t volume = area * length;
 
-	//Calculated as log2(length)
-	static constexpr size_t lengthShift = 8;
-	//Calculated as log2(area)
-	static constexpr size_t areaShift = 16;
+	//Side length of a brick.
+	static constexpr size_t brickLength = 16;
+	//Calculated as log2(brickLength)
+	static constexpr size_t brickShift = 4;
+	//Number of bricks along each axis of the map.
+	static constexpr size_t bricksPerAxis = length / brickLength;
+	//Number of bricks in the map.
+	static constexpr size_t brickCount = bricksPerAxis * bricksPerAxis * bricksPerAxis;
 
 	/**
 	 * Creates a map for representing the filled areas in a chunk.
+	 * All blocks start empty.
 	 */
-	BlockMap() {}
+	BlockMap() : bricks{}, neighbors{}, touched(false) {}
+
+	/**
+	 * Sets the plane of blocks just outside the map in one direction, which
+	 * is used for faces on that edge of the map instead of counting them as
+	 * visible. The plane is reset when the map is cleared.
+	 * @param normal The face normal pointing towards the plane, as used by RegionFace.
+	 * @param plane The filled blocks next to the map, or null if unknown.
+	 */
+	void setNeighbor(size_t normal, const BoundaryPlane* plane) { neighbors.at(normal) = plane; }
+
+	/**
+	 * Sets every block in the map as empty. Only the bricks changed since the
+	 * map was last cleared are reset, and memory for mixed bricks is kept for
+	 * reuse.
+	 */
+	void clear() {
+		neighbors.fill(nullptr);
+
+		if (!touched) {
+			return;
+		}
+
+		for (size_t brickX = touchedMin.x; brickX <= touchedMax.x; brickX++) {
+			for (size_t brickY = touchedMin.y; brickY <= touchedMax.y; brickY++) {
+				uint32_t* row = &bricks[brickIndex(brickX, brickY, touchedMin.z)];
+				std::fill(row, row + (touchedMax.z - touchedMin.z + 1), (uint32_t) EMPTY);
+			}
+		}
+
+		payloads.clear();
+		touched = false;
+	}
 
 	/**
 	 * Sets the given postion as filled or empty in the map.
@@ -44,7 +190,17 @@ public:
 	 * @param val Whether to set the block as filled or empty.
 	 */
 	void setBlockFill(size_t x, size_t y, size_t z, bool val = true) {
-		map[x * area + y * length + z] = val;
+		uint32_t& brick = bricks[brickIndex(x >> brickShift, y >> brickShift, z >> brickShift)];
+
+		if (brick == (val ? FULL : EMPTY)) {
+			return;
+		}
+
+		touch(Aabb<uint8_t>(Aabb<uint8_t>::vec_t(x, y, z), Aabb<uint8_t>::vec_t(x, y, z)));
+
+		uint16_t& row = makeMixed(brick)[rowIndex(x, y)];
+		uint16_t bit = 1 << (z & (brickLength - 1));
+		row = val ? (row | bit) : (row & ~bit);
 	}
 
 	/**
@@ -53,7 +209,13 @@ public:
 	 * @return Whether the given block was filled.
 	 */
 	bool isBlockFilled(size_t x, size_t y, size_t z) const {
-		return map[x * area + y * length + z];
+		uint32_t brick = bricks[brickIndex(x >> brickShift, y >> brickShift, z >> brickShift)];
+
+		if (brick == EMPTY || brick == FULL) {
+			return brick == FULL;
+		}
+
+		return (payloads[brick - MIXED_START][rowIndex(x, y)] >> (z & (brickLength - 1))) & 1;
 	}
 
 	/**
@@ -61,127 +223,465 @@ public:
 	 * @param region The region to set as filled.
 	 */
 	void addRegionFill(const InternalRegion& region) {
-		Aabb<uint64_t> regBox(region.box);
-		regBox.max += Aabb<uint64_t>::vec_t(1, 1, 1);
-
-		Aabb<uint64_t>::vec_t min = regBox.min;
-		Aabb<uint64_t>::vec_t max = regBox.max;
-
-		//It doesn't matter if max underflows, it'll just end up as 0, as it should
-		uint64_t mask1 = regionMask(min.z, max.z, 0, 64);
-		uint64_t mask2 = regionMask(min.z, max.z, 64, 128);
-		uint64_t mask3 = regionMask(min.z, max.z, 128, 192);
-		uint64_t mask4 = regionMask(min.z, max.z, 192, 256);
-
-		for (uint64_t x = min.x; x < max.x; x++) {
-			for (uint64_t y = min.y; y < max.y; y++) {
-				//Hack to get internal data. Need own implementation later to avoid undefined behaviour.
-				uint64_t* mapData = (uint64_t*)&map;
-
-				uint64_t baseIndex = (x * area + y * length) / 64;
-				mapData[baseIndex] |= mask1;
-				mapData[baseIndex + 1] |= mask2;
-				mapData[baseIndex + 2] |= mask3;
-				mapData[baseIndex + 3] |= mask4;
+		const Aabb<uint8_t>& box = region.box;
+		touch(box);
+
+		forEachBrick(box, [&](size_t brickX, size_t brickY, size_t brickZ, const Aabb<uint8_t>& part) {
+			uint32_t& brick = bricks[brickIndex(brickX, brickY, brickZ)];
+
+			if (brick == FULL) {
+				return true;
 			}
-		}
+
+			//Bricks inside the region don't need their blocks set one at a time
+			if (part.max.x - part.min.x + 1 == brickLength && part.max.y - part.min.y + 1 == brickLength &&
+				part.max.z - part.min.z + 1 == brickLength) {
+
+				brick = FULL;
+				return true;
+			}
+
+			fillRows(makeMixed(brick), part, rowMask(part.min.z, part.max.z));
+			return true;
+		});
+	}
+
+	/**
+	 * Checks whether every block in the given range is filled.
+	 * @param box The block range to check.
+	 * @return Whether the whole range is filled.
+	 */
+	bool isBoxFilled(const Aabb<uint8_t>& box) const {
+		return forEachBrick(box, [&](size_t brickX, size_t brickY, size_t brickZ, const Aabb<uint8_t>& part) {
+			uint32_t brick = bricks[brickIndex(brickX, brickY, brickZ)];
+
+			if (brick == EMPTY || brick == FULL) {
+				return brick == FULL;
+			}
+
+			return areRowsFilled(payloads[brick - MIXED_START], part, rowMask(part.min.z, part.max.z));
+		});
+	}
+
+	/**
+	 * Checks whether every block in the given range is empty.
+	 * @param box The block range to check.
+	 * @return Whether the whole range is empty.
+	 */
+	bool isBoxEmpty(const Aabb<uint8_t>& box) const {
+		return forEachBrick(box, [&](size_t brickX, size_t brickY, size_t brickZ, const Aabb<uint8_t>& part) {
+			uint32_t brick = bricks[brickIndex(brickX, brickY, brickZ)];
+
+			if (brick == EMPTY || brick == FULL) {
+				return brick == EMPTY;
+			}
+
+			return areRowsEmpty(payloads[brick - MIXED_START], part, rowMask(part.min.z, part.max.z));
+		});
 	}
 
 	/**
 	 * Checks whether the face is visible based on the internal map. Faces
-	 * on the edge of the map are always counted as visible.
+	 * on the edge of the map are checked against the neighboring plane, or
+	 * counted as visible if there is none.
 	 * @param face The face to check.
 	 * @return Whether the face is visible.
 	 */
 	bool isFaceVisible(const RegionFace& face) const {
-		uint64_t fixed = face.getFixedCoord();
-		uint64_t normal = face.getNormal();
-		bool visible = false;
+		Aabb<uint8_t> layer;
 
 		//Check if face is actually in the map
-		if (fixed == 0 || fixed == length) {
-			return true;
+		if (!getFrontLayer(face, layer)) {
+			const BoundaryPlane* plane = neighbors.at(face.getNormal());
+			return !plane || !plane->isRectFilled(face.min, face.max);
 		}
 
-		//Innermost loop along z axis, allows for fused visibility checks
-		//This is for the east, west, up, and down axis
-		if (normal != 0 && normal != 2) {
-			uint64_t minZ = face.min.at(1);
-			uint64_t maxZ = face.max.at(1);
+		//The face is covered if the layer of blocks in front of it is filled
+		return !isBoxFilled(layer);
+	}
 
-			if (normal == 3 || normal == 5) {
-				fixed--;
-			}
+	/**
+	 * Splits a face into the parts which aren't covered by filled blocks.
+	 * The visible blocks are merged greedily into rectangles, one row at a
+	 * time. Faces on the edge of the map are split using the neighboring
+	 * plane, or are fully visible if there is none.
+	 * @param face The face to split.
+	 * @param out The vector to add the visible parts to.
+	 */
+	void addVisibleParts(const RegionFace& face, std::vector<RegionFace>& out) const {
+		Aabb<uint8_t> layer(Aabb<uint8_t>::vec_t(0, 0, 0), Aabb<uint8_t>::vec_t(0, 0, 0));
+		bool inMap = getFrontLayer(face, layer);
+		const BoundaryPlane* plane = inMap ? nullptr : neighbors.at(face.getNormal());
+
+		if (!inMap && !plane) {
+			out.push_back(face);
+			return;
+		}
+
+		if (inMap ? isBoxEmpty(layer) : plane->isRectEmpty(face.min, face.max)) {
+			out.push_back(face);
+			return;
+		}
+
+		if (inMap ? isBoxFilled(layer) : plane->isRectFilled(face.min, face.max)) {
+			return;
+		}
+
+		size_t width = face.max.at(0) - face.min.at(0);
+		size_t height = face.max.at(1) - face.min.at(1);
+		std::vector<uint8_t> open(width * height);
+
+		//Find which blocks in front of the face are empty
+		std::array<size_t, 2> axes = layerAxes(face);
+		Aabb<uint8_t>::vec_t pos = layer.min;
 
-			uint64_t shift1 = areaShift;
-			uint64_t shift2 = lengthShift;
+		for (size_t v = 0; v < height; v++) {
+			for (size_t u = 0; u < width; u++) {
+				if (!inMap) {
+					open[v * width + u] = !plane->isFilled(face.min.at(0) + u, face.min.at(1) + v);
+					continue;
+				}
 
-			if (normal == 4 || normal == 5) {
-				std::swap(shift1, shift2);
+				pos[axes.at(0)] = face.min.at(0) + u;
+				pos[axes.at(1)] = face.min.at(1) + v;
+				open[v * width + u] = !isBlockFilled(pos.x, pos.y, pos.z);
 			}
+		}
+
+		for (size_t v = 0; v < height; v++) {
+			for (size_t u = 0; u < width; u++) {
+				if (!open[v * width + u]) {
+					continue;
+				}
+
+				//Extend along the row, then down as long as the whole run is open
+				size_t uEnd = u + 1;
+
+				while (uEnd < width && open[v * width + uEnd]) {
+					uEnd++;
+				}
+
+				size_t vEnd = v + 1;
+
+				while (vEnd < height && std::all_of(&open[vEnd * width + u], &open[vEnd * width + uEnd], [](uint8_t val) { return val; })) {
+					vEnd++;
+				}
 
-			uint64_t mask1 = regionMask(minZ, maxZ, 0, 64);
-			uint64_t mask2 = regionMask(minZ, maxZ, 64, 128);
-			uint64_t mask3 = regionMask(minZ, maxZ, 128, 192);
-			uint64_t mask4 = regionMask(minZ, maxZ, 192, 256);
-
-			//i is either y or x, depending on the normal direction - east/west
-			//is y, up/down is x
-			for (uint64_t i = face.min.at(0); i < face.max.at(0); i++) {
-				uint64_t* mapData = (uint64_t*)&map;
-
-				uint64_t baseIndex = ((fixed << shift1) + (i << shift2)) / 64;
-				visible =
-					((mask1 & mapData[baseIndex]) | ~mask1) != 0xFFFFFFFFFFFFFFFF ||
-					((mask2 & mapData[baseIndex + 1]) | ~mask2) != 0xFFFFFFFFFFFFFFFF ||
-					((mask3 & mapData[baseIndex + 2]) | ~mask3) != 0xFFFFFFFFFFFFFFFF ||
-					((mask4 & mapData[baseIndex + 3]) | ~mask4) != 0xFFFFFFFFFFFFFFFF;
-
-				if (visible) {
-					return visible;
+				for (size_t clearV = v; clearV < vEnd; clearV++) {
+					std::fill(&open[clearV * width + u], &open[clearV * width + uEnd], 0);
 				}
+
+				RegionFace part = face;
+				part.min = {(uint16_t) (face.min.at(0) + u), (uint16_t) (face.min.at(1) + v)};
+				part.max = {(uint16_t) (face.min.at(0) + uEnd), (uint16_t) (face.min.at(1) + vEnd)};
+				out.push_back(part);
+
+				u = uEnd - 1;
 			}
+		}
+	}
+
+	/**
+	 * Gets the number of bricks which store a bit for every block.
+	 * @return The number of mixed bricks.
+	 */
+	size_t getMixedCount() const { return payloads.size(); }
+
+	/**
+	 * Gets the name of the instruction set used to fill and check mixed
+	 * bricks, which is picked based on what the processor supports.
+	 * @return The name of the kernels in use.
+	 */
+	static const char* getKernelName();
+
+	/**
+	 * Replaces the automatically picked kernels, for comparing them. Must
+	 * not be called while block maps are in use.
+	 * @param name The name of the kernels to use, as from getKernelName.
+	 * @return Whether the kernels exist and are supported by the processor.
+	 */
+	static bool setKernels(const std::string& name);
+
+private:
+	//Bits for the blocks in a mixed brick, one row of z values for each x and y.
+	typedef std::array<uint16_t, brickLength * brickLength> Payload;
+
+	//Brick states. Values from MIXED_START on are mixed bricks, with
+	//their payload at (value - MIXED_START).
+	enum : uint32_t {
+		EMPTY = 0,
+		FULL = 1,
+		MIXED_START = 2
+	};
+
+	//State of every brick.
+	std::array<uint32_t, brickCount> bricks;
+	//Bits for the mixed bricks.
+	std::vector<Payload> payloads;
+	//Blocks just outside the map, indexed by the normal of faces pointing at them.
+	std::array<const BoundaryPlane*, 6> neighbors;
+	//Whether any bricks were changed since the map was last cleared.
+	bool touched;
+	//Range of bricks changed since the map was last cleared, in brick coordinates.
+	Aabb<uint8_t>::vec_t touchedMin;
+	Aabb<uint8_t>::vec_t touchedMax;
+
+	/**
+	 * Adds the bricks overlapping a block range to the range reset by clear().
+	 * @param box The changed block range.
+	 */
+	void touch(const Aabb<uint8_t>& box) {
+		Aabb<uint8_t>::vec_t brickMin(box.min.x >> brickShift, box.min.y >> brickShift, box.min.z >> brickShift);
+		Aabb<uint8_t>::vec_t brickMax(box.max.x >> brickShift, box.max.y >> brickShift, box.max.z >> brickShift);
+
+		touchedMin = touched ? glm::min(touchedMin, brickMin) : brickMin;
+		touchedMax = touched ? glm::max(touchedMax, brickMax) : brickMax;
+		touched = true;
+	}
+
+	/**
+	 * Gets the index of a brick in the brick array.
+	 */
+	static size_t brickIndex(size_t brickX, size_t brickY, size_t brickZ) {
+		return (brickX * bricksPerAxis + brickY) * bricksPerAxis + brickZ;
+	}
+
+	/**
+	 * Gets the index of the row containing a block in its brick's payload.
+	 */
+	static size_t rowIndex(size_t x, size_t y) {
+		return (x & (brickLength - 1)) * brickLength + (y & (brickLength - 1));
+	}
+
+	/**
+	 * Gets a mask with the bits for the z values from min to max set. Only
+	 * the position within a brick is used.
+	 */
+	static uint16_t rowMask(size_t min, size_t max) {
+		size_t low = min & (brickLength - 1);
+		size_t high = max & (brickLength - 1);
+
+		return (uint16_t) ((0xFFFFu >> (brickLength - 1 - high)) & (0xFFFFu << low));
+	}
+
+	/**
+	 * Sets bits in the rows of a mixed brick.
+	 * @param payload The brick's bits.
+	 * @param part The range of rows to change, only the x and y positions
+	 *     within the brick are used.
+	 * @param mask The bits to set in each row.
+	 */
+	static void fillRows(Payload& payload, const Aabb<uint8_t>& part, uint16_t mask);
+
+	/**
+	 * Checks whether bits are set in the rows of a mixed brick.
+	 * @param payload The brick's bits.
+	 * @param part The range of rows to check, only the x and y positions
+	 *     within the brick are used.
+	 * @param mask The bits to check in each row.
+	 * @return Whether all the bits were set in every row.
+	 */
+	static bool areRowsFilled(const Payload& payload, const Aabb<uint8_t>& part, uint16_t mask);
 
+	/**
+	 * Checks whether bits are clear in the rows of a mixed brick.
+	 * @param payload The brick's bits.
+	 * @param part The range of rows to check, only the x and y positions
+	 *     within the brick are used.
+	 * @param mask The bits to check in each row.
+	 * @return Whether all the bits were clear in every row.
+	 */
+	static bool areRowsEmpty(const Payload& payload, const Aabb<uint8_t>& part, uint16_t mask);
+
+	/**
+	 * Gets the axes a face's min and max coordinates are along.
+	 * @param face The face.
+	 * @return The axes for the first and second coordinates.
+	 */
+	static std::array<size_t, 2> layerAxes(const RegionFace& face) {
+		switch (face.getNormal()) {
+			case 0:
+			case 2: return {0, 1};
+			case 1:
+			case 3: return {1, 2};
+			default: return {0, 2};
+		}
+	}
+
+	/**
+	 * Gets the layer of blocks directly in front of a face.
+	 * @param face The face.
+	 * @param layer Set to the blocks in front of the face.
+	 * @return False if the face is on the edge of the map, so there are no
+	 *     blocks in front of it.
+	 */
+	static bool getFrontLayer(const RegionFace& face, Aabb<uint8_t>& layer) {
+		uint16_t fixed = face.getFixedCoord();
+		uint16_t normal = face.getNormal();
+
+		if (fixed == 0 || fixed == length) {
 			return false;
 		}
 
-		for (uint64_t i = face.min.at(0); i < face.max.at(0); i++) {
-			for (uint64_t j = face.min.at(1); j < face.max.at(1); j++) {
-				if (normal == 0) {
-					visible = !isBlockFilled(i, j, fixed - 1);
-				}
-				else if (normal == 2) {
-					visible = !isBlockFilled(i, j, fixed);
-				}
+		std::array<size_t, 2> axes = layerAxes(face);
+		size_t fixedAxis = 3 - axes.at(0) - axes.at(1);
+
+		//North, west, and down faces are at the low side of their block
+		uint8_t fixedBlock = (normal == 0 || normal == 3 || normal == 5) ? fixed - 1 : fixed;
+
+		Aabb<uint8_t>::vec_t min;
+		Aabb<uint8_t>::vec_t max;
+
+		min[fixedAxis] = fixedBlock;
+		max[fixedAxis] = fixedBlock;
+		min[axes.at(0)] = face.min.at(0);
+		max[axes.at(0)] = face.max.at(0) - 1;
+		min[axes.at(1)] = face.min.at(1);
+		max[axes.at(1)] = face.max.at(1) - 1;
+
+		layer = Aabb<uint8_t>(min, max);
+		return true;
+	}
 
-				if (visible) {
-					return visible;
+	/**
+	 * Turns a brick into a mixed brick, keeping which blocks are filled.
+	 * @param brick The brick's state.
+	 * @return The brick's payload.
+	 */
+	Payload& makeMixed(uint32_t& brick) {
+		if (brick >= MIXED_START) {
+			return payloads[brick - MIXED_START];
+		}
+
+		Payload fill;
+		fill.fill(brick == FULL ? 0xFFFF : 0);
+
+		brick = payloads.size() + MIXED_START;
+		payloads.push_back(fill);
+
+		return payloads.back();
+	}
+
+	/**
+	 * Calls a function for every brick overlapping a block range, stopping
+	 * early if the function returns false.
+	 * @param box The block range.
+	 * @param fn Takes the brick's coordinates and the part of the range inside it.
+	 * @return False if the function returned false, true otherwise.
+	 */
+	template<typename Func>
+	static bool forEachBrick(const Aabb<uint8_t>& box, Func fn) {
+		for (size_t brickX = box.min.x >> brickShift; brickX <= (size_t) (box.max.x >> brickShift); brickX++) {
+			for (size_t brickY = box.min.y >> brickShift; brickY <= (size_t) (box.max.y >> brickShift); brickY++) {
+				for (size_t brickZ = box.min.z >> brickShift; brickZ <= (size_t) (box.max.z >> brickShift); brickZ++) {
+					Aabb<uint8_t>::vec_t brickMin(brickX << brickShift, brickY << brickShift, brickZ << brickShift);
+					Aabb<uint8_t>::vec_t brickMax(brickMin.x + brickLength - 1, brickMin.y + brickLength - 1, brickMin.z + brickLength - 1);
+
+					Aabb<uint8_t> part(glm::max(box.min, brickMin), glm::min(box.max, brickMax));
+
+					if (!fn(brickX, brickY, brickZ, part)) {
+						return false;
+					}
 				}
 			}
 		}
 
-		return visible;
+		return true;
 	}
+};
+
+/**
+ * Keeps cleared block maps around for each thread, so generating meshes
+ * doesn't need to allocate a new map every time.
+ */
+class BlockMapPool {
+public:
+	//Maximum number of free maps kept by each thread.
+	static constexpr size_t maxFreeMaps = 4;
+
+	struct Stats {
+		//Maps reused from a thread's pool.
+		size_t hits;
+		//Maps which had to be allocated.
+		size_t misses;
+	};
 
 	/**
-	 * Gets the map of covered blocks.
-	 * @return The block coverage map.
+	 * Returns its map to the pool of the thread it was acquired on when destroyed.
 	 */
-	const std::bitset<volume>& getMap() const { return map; }
+	class Handle {
+	public:
+		Handle(std::unique_ptr<BlockMap> map) : map(std::move(map)) {}
+		Handle(Handle&& other) = default;
+
+		~Handle() {
+			if (map) {
+				release(std::move(map));
+			}
+		}
 
-private:
-	//Stores which blocks are filled in the chunk.
-	std::bitset<volume> map;
+		BlockMap* operator->() const { return map.get(); }
+		BlockMap& operator*() const { return *map; }
 
-	static constexpr uint64_t regionMask(uint64_t min, uint64_t max, uint64_t clampMin, uint64_t clampMax) {
-		uint64_t shiftMin = std::max(min, clampMin) - clampMin;
-		uint64_t shiftMax = clampMax - std::min(max, clampMax);
+	private:
+		std::unique_ptr<BlockMap> map;
+	};
+
+	/**
+	 * Gets an empty map from the calling thread's pool, allocating one if
+	 * the pool is empty. The map must be released on the same thread.
+	 * @return A handle to the map.
+	 */
+	static Handle acquire() {
+		std::vector<std::unique_ptr<BlockMap>>& pool = getFreeMaps();
 
-		//As it turns out, shifting past bitwidth is undefined behaviour.
-		if (shiftMin >= 64 || shiftMax >= 64) {
-			return 0;
+		if (pool.empty()) {
+			getMisses()++;
+			return Handle(std::make_unique<BlockMap>());
 		}
 
-		return (0xFFFFFFFFFFFFFFFFul << shiftMin) & (0xFFFFFFFFFFFFFFFFul >> shiftMax);
+		getHits()++;
+		std::unique_ptr<BlockMap> map = std::move(pool.back());
+		pool.pop_back();
+
+		return Handle(std::move(map));
+	}
+
+	/**
+	 * Gets how many maps were reused or allocated, over all threads.
+	 * @return The pool's usage statistics.
+	 */
+	static Stats getStats() {
+		return {getHits().load(), getMisses().load()};
+	}
+
+private:
+	/**
+	 * Clears a map and adds it to the calling thread's pool, or frees it if
+	 * the pool is full.
+	 * @param map The map to release.
+	 */
+	static void release(std::unique_ptr<BlockMap> map) {
+		std::vector<std::unique_ptr<BlockMap>>& pool = getFreeMaps();
+
+		if (pool.size() < maxFreeMaps) {
+			map->clear();
+			pool.push_back(std::move(map));
+		}
+	}
+
+	static std::vector<std::unique_ptr<BlockMap>>& getFreeMaps() {
+		thread_local std::vector<std::unique_ptr<BlockMap>> freeMaps;
+		return freeMaps;
+	}
+
+	static std::atomic<size_t>& getHits() {
+		static std::atomic<size_t> hits(0);
+		return hits;
+	}
+
+	static std::atomic<size_t>& getMisses() {
+		static std::atomic<size_t> misses(0);
+		return misses;
 	}
 };
@@ -0,0 +1,50 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+//Helpers for reading and writing saved data, which is always
+//little endian regardless of platform.
+
+inline void putU16(unsigned char* out, uint16_t val) {
+	out[0] = val & 0xFF;
+	out[1] = val >> 8;
+}
+
+inline void putU32(unsigned char* out, uint32_t val) {
+	for (size_t i = 0; i < 4; i++) {
+		out[i] = (val >> (8 * i)) & 0xFF;
+	}
+}
+
+inline uint16_t getU16(const unsigned char* in) {
+	return in[0] | (in[1] << 8);
+}
+
+inline uint32_t getU32(const unsigned char* in) {
+	uint32_t val = 0;
+
+	for (size_t i = 0; i < 4; i++) {
+		val |= ((uint32_t) in[i]) << (8 * i);
+	}
+
+	return val;
+}
@@ -16,7 +16,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  ******************************************************************************/
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include "Chunk.hpp"
 #include "Engine.hpp"
@@ -25,26 +29,344 @@
 #include "ScreenComponents.hpp"
 
 namespace {
+	/**
+	 * Gets the boundary shared by all chunks with a completely empty side.
+	 */
+	const std::shared_ptr<const BoundaryPlane>& getEmptyPlane() {
+		static const std::shared_ptr<const BoundaryPlane> emptyPlane = std::make_shared<BoundaryPlane>();
+		return emptyPlane;
+	}
+
+	/**
+	 * Gets the boundary shared by all chunks with a completely full side.
+	 */
+	const std::shared_ptr<const BoundaryPlane>& getFullPlane() {
+		static const std::shared_ptr<const BoundaryPlane> fullPlane = []() {
+			std::shared_ptr<BoundaryPlane> full = std::make_shared<BoundaryPlane>();
+			full->fillRect({0, 0}, {BoundaryPlane::length, BoundaryPlane::length});
+			return full;
+		}();
+
+		return fullPlane;
+	}
+
+	/**
+	 * Gets the memory used by a boundary, which is nothing for the shared ones.
+	 */
+	size_t planeMemUsage(const std::shared_ptr<const BoundaryPlane>& plane) {
+		return (plane && plane != getEmptyPlane() && plane != getFullPlane()) ? sizeof(BoundaryPlane) : 0;
+	}
+
 	struct ChunkVert {
 		glm::vec3 pos;
 		uint32_t normColPack;
 	};
+
+	//Used instead of ChunkVert when Voxex::PACKED_CHUNK_VERTICES is set.
+	//Positions are relative to the chunk's minimum corner, without
+	//centering or flipping z.
+	struct PackedChunkVert {
+		//9 bits each for x, y, and z, then 3 bits for the normal.
+		uint32_t posNormPack;
+		uint32_t type;
+	};
+
+	/**
+	 * Gets the indices for drawing quads, which are the same for every
+	 * chunk. The pattern is generated once and shared between meshes, and
+	 * only regenerated when a mesh has more quads than ever before.
+	 * @param quadCount The number of quads needed.
+	 * @return Indices for at least quadCount quads.
+	 */
+	std::shared_ptr<const std::vector<uint32_t>> getQuadIndices(size_t quadCount) {
+		static std::mutex patternMutex;
+		static std::shared_ptr<const std::vector<uint32_t>> pattern = std::make_shared<std::vector<uint32_t>>();
+
+		std::lock_guard<std::mutex> lock(patternMutex);
+
+		if (pattern->size() >= quadCount * 6) {
+			return pattern;
+		}
+
+		size_t newQuads = std::max(quadCount, pattern->size() / 6 * 2);
+		std::shared_ptr<std::vector<uint32_t>> indices = std::make_shared<std::vector<uint32_t>>(newQuads * 6, 0);
+
+		for (size_t quad = 0; quad < newQuads; quad++) {
+			//When adding the indices, do two 32-bit values at a time for moderate speedup
+			//The order of the added indices is 1, 0, 3, 3, 0, 2
+			uint64_t* indexData = (uint64_t*) indices->data();
+			size_t index = quad * 3;
+			uint64_t baseIndex = quad * 4;
+
+			uint64_t val = (baseIndex << 32) | baseIndex;
+
+			indexData[index] = val + 1ul;
+			indexData[index + 1] = val + 12884901891ul;
+			indexData[index + 2] = val + 8589934592ul;
+		}
+
+		pattern = indices;
+		return pattern;
+	}
+
+	//Keeps mesh names unique, since meshes can be generated on any thread.
+	std::atomic<size_t> nextMeshId(0);
+
+	/**
+	 * Checks whether a face lies inside one of the given faces, which means
+	 * it was split from it.
+	 */
+	bool isPartOfAny(const RegionFace& part, const std::vector<RegionFace>& wholeFaces) {
+		for (const RegionFace& whole : wholeFaces) {
+			if (part.normFixed == whole.normFixed &&
+				part.min.at(0) >= whole.min.at(0) && part.min.at(1) >= whole.min.at(1) &&
+				part.max.at(0) <= whole.max.at(0) && part.max.at(1) <= whole.max.at(1)) {
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Gets the layer of blocks on one side of a chunk.
+	 * @param side The side, numbered like RegionFace normals.
+	 * @return The blocks on that side.
+	 */
+	Aabb<uint8_t> sideLayer(size_t side) {
+		Aabb<uint8_t>::vec_t min(0, 0, 0);
+		Aabb<uint8_t>::vec_t max(255, 255, 255);
+
+		switch (side) {
+			case 0: max.z = 0; break;
+			case 1: min.x = 255; break;
+			case 2: min.z = 255; break;
+			case 3: max.x = 0; break;
+			case 4: min.y = 255; break;
+			case 5: max.y = 0; break;
+			default: throw std::invalid_argument("Invalid chunk side!");
+		}
+
+		return Aabb<uint8_t>(min, max);
+	}
+}
+
+std::shared_ptr<Chunk> Chunk::createUniform(const Aabb<int64_t>& box, bool solid, uint16_t type) {
+	static std::mutex uniformMutex;
+	static std::unordered_map<uint16_t, std::shared_ptr<const RegionTree>> solidTrees;
+	static const std::shared_ptr<const RegionTree> emptyTree = std::make_shared<RegionTree>();
+
+	if (!solid) {
+		std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>(box, emptyTree->getView(), emptyTree);
+		chunk->uniform = true;
+		return chunk;
+	}
+
+	std::shared_ptr<const RegionTree> tree;
+
+	{
+		std::lock_guard<std::mutex> lock(uniformMutex);
+		std::shared_ptr<const RegionTree>& solidTree = solidTrees[type];
+
+		if (!solidTree) {
+			std::shared_ptr<RegionTree> newTree = std::make_shared<RegionTree>();
+			newTree->addRegions({{type, Aabb<uint8_t>(Aabb<uint8_t>::vec_t(0, 0, 0), Aabb<uint8_t>::vec_t(255, 255, 255))}});
+			solidTree = newTree;
+		}
+
+		tree = solidTree;
+	}
+
+	std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>(box, tree->getView(), tree);
+	chunk->uniform = true;
+	return chunk;
+}
+
+void Chunk::addRegion(const Region& reg) {
+	std::lock_guard<std::mutex> lock(meshMutex);
+	thaw();
+
+	Aabb<uint8_t> localBox = toLocal(reg.box);
+	Aabb<uint8_t> changed = localBox;
+
+	regions.insertUncovered({reg.type, localBox}, changed);
+	markChanged(changed);
+}
+
+bool Chunk::getBlock(const Pos_t& pos, uint16_t& type) const {
+	if (pos.x < box.min.x || pos.y < box.min.y || pos.z < box.min.z ||
+		pos.x >= box.max.x || pos.y >= box.max.y || pos.z >= box.max.z) {
+		return false;
+	}
+
+	const InternalRegion* reg = getRegionView().query(Aabb<uint8_t>::vec_t(pos - box.min));
+
+	if (reg) {
+		type = reg->type;
+	}
+
+	return reg != nullptr;
+}
+
+bool Chunk::raycast(const glm::vec3& origin, const glm::vec3& dir, float minDist, float maxDist, BlockHit& hit) const {
+	//Normals for each face number in RegionFace, last one for rays starting in a region
+	static const std::array<Pos_t, 7> faceNormals = {
+		Pos_t(0, 0, -1), Pos_t(1, 0, 0), Pos_t(0, 0, 1), Pos_t(-1, 0, 0), Pos_t(0, 1, 0), Pos_t(0, -1, 0), Pos_t(0, 0, 0)
+	};
+
+	RegionHit regionHit;
+
+	if (!getRegionView().raycast(origin - glm::vec3(box.min), dir, minDist, maxDist, regionHit)) {
+		return false;
+	}
+
+	hit.block = box.min + Pos_t(regionHit.block);
+	hit.normal = faceNormals.at(regionHit.face);
+	hit.type = regionHit.region.type;
+	hit.distance = regionHit.distance;
+
+	return true;
+}
+
+void Chunk::fillBox(const Aabb<int64_t>& fill, uint16_t type, bool merge) {
+	std::lock_guard<std::mutex> lock(meshMutex);
+	thaw();
+
+	Aabb<uint8_t> localBox = toLocal(fill);
+	Aabb<uint8_t> changed = localBox;
+
+	regions.removeBox(localBox, changed);
+	regions.insertRegion({type, localBox}, changed);
+
+	if (merge) {
+		changed = Aabb<uint8_t>(changed, regions.mergeAround(localBox));
+	}
+
+	markChanged(changed);
+}
+
+void Chunk::clearBox(const Aabb<int64_t>& clear, bool merge) {
+	std::lock_guard<std::mutex> lock(meshMutex);
+	thaw();
+
+	Aabb<uint8_t> localBox = toLocal(clear);
+	Aabb<uint8_t> changed = localBox;
+
+	if (!regions.removeBox(localBox, changed)) {
+		return;
+	}
+
+	if (merge) {
+		changed = Aabb<uint8_t>(changed, regions.mergeAround(localBox));
+	}
+
+	markChanged(changed);
+}
+
+bool Chunk::needsRemesh(const ChunkNeighbors& neighbors) const {
+	std::lock_guard<std::mutex> lock(meshMutex);
+
+	if (!dirtyBoxes.empty()) {
+		return true;
+	}
+
+	//Empty chunks never have faces, whatever their neighbors are
+	if (faces.empty() && getRegionView().size() == 0) {
+		return false;
+	}
+
+	//Chunks added without a mesh, like uniform ones, still need their first one.
+	//Uniform chunks only have faces next to other chunks, so they wait for all
+	//of them rather than meshing whole sides against unloaded space.
+	if (!facesCached) {
+		return !uniform || std::all_of(neighbors.begin(), neighbors.end(), [](const std::shared_ptr<const BoundaryPlane>& plane) {
+			return plane != nullptr;
+		});
+	}
+
+	for (size_t normal = 0; normal < neighbors.size(); normal++) {
+		if (neighbors.at(normal) && neighbors.at(normal) != meshNeighbors.at(normal)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::shared_ptr<const BoundaryPlane> Chunk::getBoundary(size_t side) const {
+	{
+		std::lock_guard<std::mutex> boundaryLock(boundaryMutex);
+
+		if (boundaries.at(side)) {
+			return boundaries.at(side);
+		}
+	}
+
+	//Building the plane reads the regions, so edits have to wait
+	std::lock_guard<std::mutex> lock(meshMutex);
+	std::shared_ptr<BoundaryPlane> plane = std::make_shared<BoundaryPlane>();
+
+	getRegionView().forEachOverlapping(sideLayer(side), [&](const InternalRegion& reg) {
+		//Use the face on that side to get the region's extent in the plane's axes
+		RegionFace face = RegionTree::genRegionFaces(reg).at(side);
+		plane->fillRect(face.min, face.max);
+	});
+
+	std::lock_guard<std::mutex> boundaryLock(boundaryMutex);
+
+	if (plane->isEmpty()) {
+		boundaries.at(side) = getEmptyPlane();
+	}
+	else if (plane->isFull()) {
+		boundaries.at(side) = getFullPlane();
+	}
+	else {
+		boundaries.at(side) = plane;
+	}
+
+	return boundaries.at(side);
+}
+
+size_t Chunk::getMemUsage() const {
+	std::lock_guard<std::mutex> lock(meshMutex);
+	size_t planeBytes = 0;
+
+	//Boundaries are only changed with meshMutex held, so they can be read here.
+	//Neighbor planes may also be cached by the neighbor, and are counted by
+	//both, as this chunk keeps them alive until its next mesh.
+	for (size_t side = 0; side < boundaries.size(); side++) {
+		planeBytes += planeMemUsage(boundaries.at(side)) + planeMemUsage(meshNeighbors.at(side));
+	}
+
+	return sizeof(Chunk) - sizeof(RegionTree) + regions.getMemUsage() + faces.capacity() * sizeof(RegionFace) +
+		dirtyBoxes.capacity() * sizeof(Aabb<uint8_t>) + planeBytes;
 }
 
-ChunkMeshData Chunk::generateMesh() {
+ChunkMeshData Chunk::generateMesh(const ChunkNeighbors& neighbors) {
 //	double start = ExMath::getTimeMillis();
 
-	std::vector<RegionFace> faces = regions.genQuads();
+	//Only hold the lock while updating faces, so edits aren't blocked
+	//while the vertices are built
+	std::vector<RegionFace> meshFaces;
+
+	{
+		std::lock_guard<std::mutex> lock(meshMutex);
+		updateFaces(neighbors);
+		meshFaces = faces;
+	}
 
 //	double end = ExMath::getTimeMillis();
 
-	std::vector<unsigned char> vertexData(faces.size() * 4 * sizeof(ChunkVert), 0);
+	//Mesh always uploads an index range for each mesh, so every quad keeps
+	//4 vertices and a copy of the shared index pattern
+	const size_t vertexSize = Voxex::PACKED_CHUNK_VERTICES ? sizeof(PackedChunkVert) : sizeof(ChunkVert);
+	std::vector<unsigned char> vertexData(meshFaces.size() * 4 * vertexSize, 0);
 	size_t lastVertex = 0;
-	std::vector<uint32_t> indices(faces.size() * 6, 0);
-
-	for (const RegionFace& face : faces) {
-		size_t baseIndex = lastVertex;
+	std::shared_ptr<const std::vector<uint32_t>> indexPattern = getQuadIndices(meshFaces.size());
+	std::vector<uint32_t> indices(indexPattern->begin(), indexPattern->begin() + meshFaces.size() * 6);
 
+	for (const RegionFace& face : meshFaces) {
 		std::array<glm::vec3, 4> positions;
 
 		std::array<float, 2> min = {(float)face.min.at(0), (float)face.min.at(1)};
@@ -98,6 +420,22 @@ ChunkMeshData Chunk::generateMesh() {
 		}
 
 		for (size_t i = 0; i < positions.size(); i++) {
+			uint32_t normal = face.getNormal();
+			uint32_t type = face.type;
+
+			if (Voxex::PACKED_CHUNK_VERTICES) {
+				//The shader centers the chunk and inverts z
+				PackedChunkVert vert;
+
+				vert.posNormPack = (uint32_t) positions.at(i).x | ((uint32_t) positions.at(i).y << 9) |
+					((uint32_t) positions.at(i).z << 18) | (normal << 27);
+				vert.type = type;
+
+				memcpy(&vertexData.data()[lastVertex * sizeof(PackedChunkVert)], &vert, sizeof(PackedChunkVert));
+				lastVertex++;
+				continue;
+			}
+
 			//Center the chunk, invert z
 			positions.at(i) -= glm::vec3(128, 128, 128);
 			positions.at(i).z = -positions.at(i).z;
@@ -106,49 +444,25 @@ ChunkMeshData Chunk::generateMesh() {
 			ChunkVert vert;
 
 			vert.pos = positions.at(i);
-
-			uint32_t normal = face.getNormal();
-			uint32_t type = face.type;
-
 			vert.normColPack = (normal << 16) | type;
 
 			memcpy(&vertexData.data()[lastVertex * sizeof(ChunkVert)], &vert, sizeof(ChunkVert));
 			lastVertex++;
 		}
-
-		//When adding the indices, do two 32-bit values at a time for moderate speedup
-		//The order of the added indices is 1, 0, 3, 3, 0, 2
-		uint64_t* indexData = (uint64_t*) indices.data();
-		size_t index = baseIndex / 4 * 3;
-
-		uint64_t val = (((uint64_t)baseIndex) << 32) | baseIndex;
-
-		indexData[index] = val + 1ul;
-		indexData[index + 1] = val + 12884901891ul;
-		indexData[index + 2] = val + 8589934592ul;
 	}
 
-	std::string modelName = "Chunk_" + std::to_string(box.min.x) + "_" + std::to_string(box.min.y) + "_" + std::to_string(box.min.z) + "_t" + std::to_string(loadTimer);
-
-	Mesh::BufferInfo buffers = {
-		.vertex = Engine::instance->getModelManager().getMemoryManager()->getBuffer(CHUNK_VERTEX_BUFFER),
-		.index = Engine::instance->getModelManager().getMemoryManager()->getBuffer(CHUNK_INDEX_BUFFER),
-		.vertexName = CHUNK_VERTEX_BUFFER,
-		.indexName = CHUNK_INDEX_BUFFER,
-	};
-
-	//Distance from the center to the corner, calculated with many square roots
-	float radius = 221.7025033688163f;
-	const VertexFormat* format = Engine::instance->getModelManager().getFormat(CHUNK_FORMAT);
+	std::string modelName = "Chunk_" + std::to_string(box.min.x) + "_" + std::to_string(box.min.y) + "_" + std::to_string(box.min.z) + "_m" + std::to_string(nextMeshId++);
 
 	ChunkMeshData out = {
 		.name = modelName,
-		.mesh = Mesh(buffers, format, std::move(vertexData), std::move(indices), box, radius),
+		.vertexData = std::move(vertexData),
+		.indices = std::move(indices),
+		.faceCount = meshFaces.size(),
 	};
 
 //	double vertEnd = ExMath::getTimeMillis();
 
-//	std::cout << "Reduced from " << (regions.size() * 6) << " to " << faces.size() << " faces - " <<
+//	std::cout << "Reduced from " << (regions.size() * 6) << " to " << meshFaces.size() << " faces - " <<
 //				 "completed in " << (end-start) << "ms\n";
 
 //	std::cout << "Vertex generation: " << (vertEnd - end) << "ms\n";
@@ -160,18 +474,160 @@ ChunkMeshData Chunk::generateMesh() {
 void Chunk::printStats() {
 	//std::cout << "Tree loads: " << "\n";
 	//regions.printCounts();
+	if (archiveData) {
+		std::cout << "Regions: " << archived.size() << ", Nodes: " << archived.getNodeCount() << ", Archived\n";
+		return;
+	}
+
 	std::cout << "Regions: " << regions.size() << ", Nodes: " << regions.getNodeCount() << ", Size: " << regions.getMemUsage() << " bytes\n";
 }
 
-void Chunk::createObject() {
-	auto data = generateMesh();
+void Chunk::printMeshStats() {
+	BlockMapPool::Stats poolStats = BlockMapPool::getStats();
+	size_t poolTotal = std::max<size_t>(poolStats.hits + poolStats.misses, 1);
+
+	std::cout << "Block map pool: " << poolStats.hits << " hits, " << poolStats.misses << " misses, " <<
+		(100.0 * poolStats.hits / poolTotal) << "% hit rate, " << BlockMap::getKernelName() << " kernels\n";
+
+	ChunkMeshMemory::getVertexMemory().printStats();
+	ChunkMeshMemory::getIndexMemory().printStats();
+}
+
+void Chunk::createObject(ChunkMeshData&& data) {
+	if (data.faceCount == 0) {
+		//Nothing left to render, so just drop the old mesh
+		releaseObject();
+		return;
+	}
+
+	//Replacing the allocations releases the old mesh's space
+	vertexAllocation = ChunkMeshMemory::getVertexMemory().allocate(data.vertexData.size());
+	indexAllocation = ChunkMeshMemory::getIndexMemory().allocate(data.indices.size() * sizeof(uint32_t));
+
+	Mesh::BufferInfo buffers = {
+		.vertex = Engine::instance->getModelManager().getMemoryManager()->getBuffer(CHUNK_VERTEX_BUFFER),
+		.index = Engine::instance->getModelManager().getMemoryManager()->getBuffer(CHUNK_INDEX_BUFFER),
+		.vertexName = CHUNK_VERTEX_BUFFER,
+		.indexName = CHUNK_INDEX_BUFFER,
+	};
+
+	//Distance from the center to the corner, calculated with many square roots
+	float radius = 221.7025033688163f;
+	const VertexFormat* format = Engine::instance->getModelManager().getFormat(CHUNK_FORMAT);
 
 	object = std::make_shared<Object>();
 
-	Engine::instance->getModelManager().addMesh(data.name, std::move(data.mesh), false);
+	Engine::instance->getModelManager().addMesh(data.name, Mesh(buffers, format, std::move(data.vertexData), std::move(data.indices), box, radius), false);
 
+	//Collision comes from TerrainCollider, so the mesh is only rendered
 	object->addComponent<RenderComponent>(CHUNK_MAT, data.name);
-	glm::vec3 blockPos = box.getCenter();
-	blockPos.z = -blockPos.z;
-	object->addComponent<PhysicsComponent>(std::make_shared<PhysicsObject>(data.name, blockPos));
+}
+
+void Chunk::releaseObject() {
+	object.reset();
+	vertexAllocation.reset();
+	indexAllocation.reset();
+}
+
+Aabb<uint8_t> Chunk::toLocal(const Aabb<int64_t>& worldBox) const {
+	if (!box.contains(worldBox)) {
+		std::cout << worldBox << "\n";
+		throw std::invalid_argument("Attempt to edit blocks not within chunk!");
+	}
+
+	if (worldBox.getVolume() == 0) {
+		std::cout << worldBox << "\n";
+		throw std::runtime_error("Attempted to edit 0-volume box!");
+	}
+
+	Pos_t min = worldBox.min - box.min;
+	Pos_t max = worldBox.max - box.min - Pos_t(1, 1, 1);
+
+	return Aabb<uint8_t>(min, max);
+}
+
+bool Chunk::clipLocal(const Aabb<int64_t>& worldBox, Aabb<uint8_t>& out) const {
+	Pos_t min = worldBox.min - box.min;
+	Pos_t max = worldBox.max - box.min - Pos_t(1, 1, 1);
+
+	for (size_t axis = 0; axis < 3; axis++) {
+		min[axis] = std::max<int64_t>(min[axis], 0);
+		max[axis] = std::min<int64_t>(max[axis], 255);
+
+		if (min[axis] > max[axis]) {
+			return false;
+		}
+	}
+
+	out = Aabb<uint8_t>(min, max);
+	return true;
+}
+
+void Chunk::updateFaces(const ChunkNeighbors& neighbors) {
+	NeighborPlanes planes;
+
+	for (size_t normal = 0; normal < neighbors.size(); normal++) {
+		planes.at(normal) = neighbors.at(normal).get();
+	}
+
+	if (facesCached) {
+		//Faces on the edge need to be culled again if the neighbor there changed
+		for (size_t normal = 0; normal < neighbors.size(); normal++) {
+			if (neighbors.at(normal) != meshNeighbors.at(normal)) {
+				dirtyBoxes.push_back(sideLayer(normal));
+			}
+		}
+
+		for (const Aabb<uint8_t>& area : dirtyBoxes) {
+			patchFaces(area, planes);
+		}
+	}
+	else {
+		faces = getRegionView().genQuads(RegionTreeView::defaultFaceMode, planes);
+		facesCached = true;
+	}
+
+	dirtyBoxes.clear();
+	meshNeighbors = neighbors;
+}
+
+void Chunk::markChanged(const Aabb<uint8_t>& changed) {
+	dirtyBoxes.push_back(changed);
+	saved = false;
+
+	std::lock_guard<std::mutex> boundaryLock(boundaryMutex);
+
+	for (size_t side = 0; side < boundaries.size(); side++) {
+		if (RegionTreeView::overlaps(changed, sideLayer(side))) {
+			boundaries.at(side).reset();
+		}
+	}
+}
+
+void Chunk::patchFaces(const Aabb<uint8_t>& area, const NeighborPlanes& neighbors) {
+	//Split faces are regenerated from the whole face, so every part of a
+	//touching face has to go, even if that part doesn't touch the area
+	std::vector<RegionFace> sourceFaces;
+	std::vector<RegionFace> newFaces = getRegionView().genQuads(area, RegionTreeView::defaultFaceMode, &sourceFaces, neighbors);
+
+	for (size_t i = 0; i < faces.size(); i++) {
+		if (faces.at(i).touches(area) || isPartOfAny(faces.at(i), sourceFaces)) {
+			faces.at(i) = faces.back();
+			faces.pop_back();
+			i--;
+		}
+	}
+
+	faces.insert(faces.end(), newFaces.begin(), newFaces.end());
+}
+
+void Chunk::thaw() {
+	if (!archiveData) {
+		return;
+	}
+
+	regions.assign(archived);
+	archived = RegionTreeView();
+	archiveData.reset();
+	uniform = false;
 }
@@ -18,55 +18,243 @@
 
 #pragma once
 
+#include <mutex>
+
 #include "AxisAlignedBB.hpp"
 #include "RegionTree.hpp"
 #include "Models/Mesh.hpp"
 #include "BlockMap.hpp"
+#include "ChunkMeshMemory.hpp"
+#include "ChunkPos.hpp"
 
 class Object;
-typedef Aabb<int64_t>::vec_t Pos_t;
 
 struct Region {
 	uint16_t type;
 	Aabb<int64_t> box;
 };
 
+//A block found by a raycast.
+struct BlockHit {
+	//The block which was hit, in world coordinates.
+	Pos_t block;
+	//Normal of the face the ray entered through, in world coordinates.
+	//All zero if the ray started inside the block.
+	Pos_t normal;
+	//Type of the block.
+	uint16_t type;
+	//Distance along the ray, in multiples of its direction vector.
+	float distance;
+};
+
+//Boundary planes of the six neighboring chunks, indexed by the normal
+//of faces pointing at them. Null if the neighbor isn't loaded.
+typedef std::array<std::shared_ptr<const BoundaryPlane>, 6> ChunkNeighbors;
+
+//Mesh data generated for a chunk, which can be made on any thread and
+//turned into the chunk's object later.
 struct ChunkMeshData {
 	std::string name;
-	Mesh mesh;
+	std::vector<unsigned char> vertexData;
+	std::vector<uint32_t> indices;
+	//Number of faces in the mesh, zero if there is nothing to render.
+	size_t faceCount;
 };
 
 class Chunk {
 public:
-	//Used for chunk loading.
-	//TODO: find better place.
-	size_t loadTimer;
-
 	Chunk(const Aabb<uint64_t>& box, const std::vector<InternalRegion>& addRegs) :
-		loadTimer(0),
+		saved(false),
+		uniform(false),
+		facesCached(false),
 		box(box) {
 
 		regions.addRegions(addRegs);
 	}
 
+	/**
+	 * Creates a chunk from an already built region tree, such as
+	 * one loaded from disk.
+	 * @param box The chunk's bounding box.
+	 * @param tree The chunk's regions.
+	 */
+	Chunk(const Aabb<int64_t>& box, RegionTree&& tree) :
+		regions(std::move(tree)),
+		saved(false),
+		uniform(false),
+		facesCached(false),
+		box(box) {}
+
+	/**
+	 * Creates a chunk which uses regions stored elsewhere in place, such as
+	 * in a memory mapped archive. The regions are copied the first time the
+	 * chunk is edited.
+	 * @param box The chunk's bounding box.
+	 * @param view The chunk's regions.
+	 * @param backing Keeps the memory used by the view alive.
+	 */
+	Chunk(const Aabb<int64_t>& box, const RegionTreeView& view, std::shared_ptr<const void> backing) :
+		archived(view),
+		archiveData(backing),
+		saved(true),
+		uniform(false),
+		facesCached(false),
+		box(box) {}
+
+	/**
+	 * Creates a chunk which is either completely empty or completely filled
+	 * with one type. Every such chunk shares the same regions, which are only
+	 * copied once the chunk is edited.
+	 * @param box The chunk's bounding box.
+	 * @param solid Whether the chunk is filled rather than empty.
+	 * @param type The type filling the chunk, if it's filled.
+	 * @return The chunk.
+	 */
+	static std::shared_ptr<Chunk> createUniform(const Aabb<int64_t>& box, bool solid, uint16_t type = 0);
+
 	/**
 	 * Adds a region to the chunk, without overwriting old regions.
 	 * @param reg The region to add.
 	 */
-	void addRegion(const Region& reg) { /** TODO **/ }
+	void addRegion(const Region& reg);
+
+	/**
+	 * Sets a single block in the chunk, replacing whatever was there before.
+	 * @param pos The position of the block, in world coordinates.
+	 * @param type The type to set the block to.
+	 */
+	void setBlock(const Pos_t& pos, uint16_t type) { fillBox(Aabb<int64_t>(pos, pos + Pos_t(1, 1, 1)), type); }
+
+	/**
+	 * Fills a box in the chunk with the given type, replacing all blocks in it.
+	 * Only the regions the box intersects are split, and the pieces are merged
+	 * back with their neighbors afterwards if requested.
+	 * @param fill The box to fill, in world coordinates.
+	 * @param type The type to fill the box with.
+	 * @param merge Whether to merge the changed regions with their neighbors.
+	 */
+	void fillBox(const Aabb<int64_t>& fill, uint16_t type, bool merge = true);
+
+	/**
+	 * Removes all blocks in the given box.
+	 * @param clear The box to clear, in world coordinates.
+	 * @param merge Whether to merge the changed regions with their neighbors.
+	 */
+	void clearBox(const Aabb<int64_t>& clear, bool merge = true);
+
+	/**
+	 * Gets the type of the block at the given position.
+	 * @param pos The position of the block, in world coordinates.
+	 * @param type Set to the block's type, if there is a block.
+	 * @return Whether there is a block at the position. Positions outside
+	 *     the chunk never have blocks.
+	 */
+	bool getBlock(const Pos_t& pos, uint16_t& type) const;
+
+	/**
+	 * Calls a function for every region overlapping the given box. Parts of
+	 * the box outside the chunk are ignored.
+	 * @param area The box to check, in world coordinates.
+	 * @param fn The function to call, taking a const Region& with its box
+	 *     in world coordinates.
+	 */
+	template<typename Func>
+	void forEachOverlapping(const Aabb<int64_t>& area, Func fn) const {
+		Aabb<uint8_t> localArea;
+
+		if (!clipLocal(area, localArea)) {
+			return;
+		}
+
+		getRegionView().forEachOverlapping(localArea, [&](const InternalRegion& reg) {
+			Pos_t min = box.min + Pos_t(reg.box.min);
+			Pos_t max = box.min + Pos_t(reg.box.max) + Pos_t(1, 1, 1);
+
+			fn(Region{reg.type, Aabb<int64_t>(min, max)});
+		});
+	}
+
+	/**
+	 * Finds the first block in the chunk hit by a ray.
+	 * @param origin The start of the ray, in world block coordinates.
+	 * @param dir The direction of the ray.
+	 * @param minDist Where to start along the ray, in multiples of dir.
+	 * @param maxDist Where to stop along the ray, in multiples of dir.
+	 * @param hit Set to the hit block, if there is one.
+	 * @return Whether a block was hit.
+	 */
+	bool raycast(const glm::vec3& origin, const glm::vec3& dir, float minDist, float maxDist, BlockHit& hit) const;
 
 	/**
 	 * Generates a mesh from this chunk using the specific colors for its regions.
-	 * @param colors The colors for the regions.
+	 * If a mesh was generated before, only the faces near areas edited since
+	 * then, or next to neighbors which changed, are regenerated. This can run
+	 * on a worker thread while the chunk is edited on another, but only one
+	 * thread may generate a mesh for the chunk at a time.
+	 * @param neighbors The neighboring chunks' boundaries, used to cull faces
+	 *     on the edges of the chunk.
 	 * @return The chunk's mesh data.
 	 */
-	ChunkMeshData generateMesh();
+	ChunkMeshData generateMesh(const ChunkNeighbors& neighbors);
+
+	/**
+	 * Returns whether the chunk was edited since its mesh was last generated.
+	 * @return Whether the chunk needs a new mesh.
+	 */
+	bool isDirty() const {
+		std::lock_guard<std::mutex> lock(meshMutex);
+		return !dirtyBoxes.empty();
+	}
+
+	/**
+	 * Returns whether the chunk needs a new mesh, either because it was edited
+	 * or because a neighbor was loaded or changed since the last mesh. Neighbors
+	 * which were unloaded don't count, since that doesn't make the mesh wrong.
+	 * Unedited uniform chunks aren't meshed until all six neighbors are loaded.
+	 * @param neighbors The neighboring chunks' current boundaries.
+	 * @return Whether the chunk should be remeshed.
+	 */
+	bool needsRemesh(const ChunkNeighbors& neighbors) const;
+
+	/**
+	 * Gets the layer of blocks on one side of the chunk, for culling the faces
+	 * of neighboring chunks. Planes are created when first requested and
+	 * replaced after edits which touch them, so a plane never changes once
+	 * it is returned.
+	 * @param side The side of the chunk, numbered like RegionFace normals.
+	 * @return The filled blocks on that side.
+	 */
+	std::shared_ptr<const BoundaryPlane> getBoundary(size_t side) const;
+
+	/**
+	 * Writes the chunk's regions to the given buffer, for saving.
+	 * @param out The buffer to append to.
+	 */
+	void serialize(std::vector<unsigned char>& out) const { getRegionView().serialize(out); }
+
+	/**
+	 * Gets a view of the chunk's regions, whether they are archived or not.
+	 * The view is invalidated by edits to the chunk.
+	 * @return The chunk's regions.
+	 */
+	RegionTreeView getRegionView() const { return archiveData ? archived : regions.getView(); }
+
+	/**
+	 * Returns whether the chunk is unchanged since it was last saved or loaded.
+	 * @return Whether saving the chunk can be skipped.
+	 */
+	bool isSaved() const { return saved; }
+
+	/**
+	 * Marks the chunk as matching the copy on disk.
+	 */
+	void markSaved() { saved = true; }
 
 	/**
 	 * Returns the number of regions in the chunk.
 	 * @return The number of regions.
 	 */
-	size_t regionCount() { return regions.size(); }
+	size_t regionCount() { return getRegionView().size(); }
 
 	/**
 	 * Prints out number of regions per node for the region tree,
@@ -74,6 +262,12 @@ public:
 	 */
 	void printStats();
 
+	/**
+	 * Prints stats shared by all chunks, which are the block map pool's hit
+	 * rate and the chunk buffers' usage.
+	 */
+	static void printMeshStats();
+
 	/**
 	 * Checks whether any regions in the chunk are overlapping.
 	 */
@@ -91,7 +285,13 @@ public:
 	 * Calculates how much memory the chunk is using.
 	 * @return The chunk's memory usage, in bytes.
 	 */
-	size_t getMemUsage() { return sizeof(Chunk) - sizeof(RegionTree) + regions.getMemUsage(); }
+	size_t getMemUsage() const;
+
+	/**
+	 * Calculates how much space the chunk's mesh takes in the chunk buffers.
+	 * @return The mesh's size, in bytes.
+	 */
+	size_t getMeshMemUsage() const { return vertexAllocation.getSize() + indexAllocation.getSize(); }
 
 	/**
 	 * Gets the object for the chunk.
@@ -100,15 +300,96 @@ public:
 	std::shared_ptr<Object> getObject() { return object; }
 
 	/**
-	 * Creates the chunk's object based on the regions currently in its tree.
+	 * Creates the chunk's object from mesh data made by generateMesh. This
+	 * replaces any previously created object. If the mesh has no faces, the
+	 * chunk has no object. Must be called on the main thread.
+	 * @param data The mesh data, which is moved into the chunk's mesh.
 	 */
-	void createObject();
+	void createObject(ChunkMeshData&& data);
+
+	/**
+	 * Drops the chunk's object and releases its mesh's space in the chunk
+	 * buffers, for when the chunk is unloaded or has nothing to render.
+	 */
+	void releaseObject();
 
 private:
 	//Object used to represent the chunk in the game world.
 	std::shared_ptr<Object> object;
+	//Space used by the object's mesh in the chunk buffers.
+	ChunkMeshMemory::Allocation vertexAllocation;
+	ChunkMeshMemory::Allocation indexAllocation;
 	//List of regions in the chunk.
 	RegionTree regions;
+	//Regions used in place of the tree while archiveData is set.
+	RegionTreeView archived;
+	//Memory containing the archived regions, null if the tree is used.
+	std::shared_ptr<const void> archiveData;
+	//Whether the chunk is unchanged since it was saved or loaded.
+	bool saved;
+	//Whether the chunk was made by createUniform and not edited since.
+	bool uniform;
+	//Faces making up the last generated mesh, patched after edits.
+	std::vector<RegionFace> faces;
+	//Whether faces is valid, false until the first mesh is generated.
+	bool facesCached;
+	//Block ranges edited since the last mesh was generated.
+	std::vector<Aabb<uint8_t>> dirtyBoxes;
+	//Guards the faces and edit tracking below, so meshes can be generated
+	//on worker threads while the chunk is edited.
+	mutable std::mutex meshMutex;
+	//Neighbor boundaries the cached faces were culled against.
+	ChunkNeighbors meshNeighbors;
+	//Cached boundaries for each side of the chunk, null until requested.
+	//Guarded by boundaryMutex, and only changed with meshMutex held as well.
+	mutable std::array<std::shared_ptr<const BoundaryPlane>, 6> boundaries;
+	//Separate from meshMutex, so cached boundaries can be read while a mesh
+	//is being generated. Always locked after meshMutex.
+	mutable std::mutex boundaryMutex;
 	//Chunk bounding box.
 	Aabb<int64_t> box;
+
+	/**
+	 * Converts a box in world coordinates to a block range in the chunk.
+	 * @param worldBox The box to convert, must be inside the chunk.
+	 * @return The blocks covered by the box.
+	 */
+	Aabb<uint8_t> toLocal(const Aabb<int64_t>& worldBox) const;
+
+	/**
+	 * Converts the part of a box in world coordinates which lies inside the
+	 * chunk to a block range.
+	 * @param worldBox The box to convert.
+	 * @param out Set to the blocks covered by the box.
+	 * @return Whether the box covers any blocks in the chunk.
+	 */
+	bool clipLocal(const Aabb<int64_t>& worldBox, Aabb<uint8_t>& out) const;
+
+	/**
+	 * Brings the cached faces up to date with edits and neighbor changes.
+	 * meshMutex must be held.
+	 * @param neighbors The neighboring chunks' boundaries.
+	 */
+	void updateFaces(const ChunkNeighbors& neighbors);
+
+	/**
+	 * Records an edit, so the faces around it are regenerated and any
+	 * boundaries it touches are rebuilt. meshMutex must be held.
+	 * @param changed The block range which changed.
+	 */
+	void markChanged(const Aabb<uint8_t>& changed);
+
+	/**
+	 * Copies archived regions into the chunk's own tree so they can be
+	 * edited. Does nothing if the chunk isn't archived.
+	 */
+	void thaw();
+
+	/**
+	 * Replaces all cached faces touching the given area with newly
+	 * generated ones.
+	 * @param area The edited block range.
+	 * @param neighbors Used to cull faces on the edges of the chunk.
+	 */
+	void patchFaces(const Aabb<uint8_t>& area, const NeighborPlanes& neighbors);
 };
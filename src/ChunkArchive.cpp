@@ -0,0 +1,206 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include <fstream>
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ChunkArchive.hpp"
+
+namespace {
+	//Identifies archives, and which version of the format they use.
+	constexpr std::array<char, 4> fileMagic = {'V', 'X', 'A', '1'};
+	//Written in native order, reads back differently on a machine with another byte order.
+	constexpr uint32_t byteOrderMark = 0x01020304;
+	//Magic, byte order mark, and chunk count.
+	constexpr size_t headerSize = 16;
+	//Arrays in the file start on multiples of this.
+	constexpr size_t arrayAlign = 8;
+
+	static_assert(sizeof(RegionNode) % alignof(RegionNode) == 0 && alignof(RegionNode) <= arrayAlign, "Unexpected RegionNode layout!");
+	static_assert(sizeof(InternalRegion) == 8, "Unexpected InternalRegion layout!");
+
+	/**
+	 * Appends raw bytes to the buffer.
+	 */
+	void append(std::vector<unsigned char>& out, const void* src, size_t size) {
+		const unsigned char* bytes = (const unsigned char*) src;
+		out.insert(out.end(), bytes, bytes + size);
+	}
+
+	/**
+	 * Pads the buffer to the next multiple of arrayAlign.
+	 */
+	void alignTo(std::vector<unsigned char>& out) {
+		out.resize((out.size() + arrayAlign - 1) / arrayAlign * arrayAlign, 0);
+	}
+}
+
+std::shared_ptr<ChunkArchive> ChunkArchive::open(const std::string& path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+
+	if (fd == -1) {
+		return nullptr;
+	}
+
+	struct stat info;
+
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t) headerSize) {
+		close(fd);
+		throw std::runtime_error("Invalid chunk archive \"" + path + "\"!");
+	}
+
+	size_t length = info.st_size;
+	void* mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+	//The mapping stays valid after the descriptor is closed
+	close(fd);
+
+	if (mapped == MAP_FAILED) {
+		throw std::runtime_error("Couldn't map chunk archive \"" + path + "\"!");
+	}
+
+	//Constructed here so the mapping is released if validation throws
+	std::shared_ptr<ChunkArchive> archive(new ChunkArchive(path, (const unsigned char*) mapped, length));
+	const unsigned char* data = archive->data;
+
+	uint32_t byteOrder;
+	uint64_t count;
+	std::memcpy(&byteOrder, data + 4, sizeof(byteOrder));
+	std::memcpy(&count, data + 8, sizeof(count));
+
+	if (!std::equal(fileMagic.begin(), fileMagic.end(), data)) {
+		throw std::runtime_error("Invalid chunk archive \"" + path + "\"!");
+	}
+
+	if (byteOrder != byteOrderMark) {
+		throw std::runtime_error("Chunk archive \"" + path + "\" was written with a different byte order!");
+	}
+
+	if (count > (length - headerSize) / sizeof(Entry)) {
+		throw std::runtime_error("Truncated chunk archive \"" + path + "\"!");
+	}
+
+	archive->entries = (const Entry*) (data + headerSize);
+	archive->chunkCount = count;
+
+	return archive;
+}
+
+void ChunkArchive::write(const std::string& path, const std::vector<std::shared_ptr<Chunk>>& chunks) {
+	std::vector<std::shared_ptr<Chunk>> sorted(chunks);
+	std::sort(sorted.begin(), sorted.end(), [](const std::shared_ptr<Chunk>& a, const std::shared_ptr<Chunk>& b) {
+		Pos_t aPos = a->getBox().min;
+		Pos_t bPos = b->getBox().min;
+		return std::tie(aPos.x, aPos.y, aPos.z) < std::tie(bPos.x, bPos.y, bPos.z);
+	});
+
+	std::vector<unsigned char> out;
+	uint64_t count = sorted.size();
+
+	append(out, fileMagic.data(), fileMagic.size());
+	append(out, &byteOrderMark, sizeof(byteOrderMark));
+	append(out, &count, sizeof(count));
+
+	//Entries are filled in once the array offsets are known
+	std::vector<Entry> table(sorted.size());
+	size_t tableStart = out.size();
+	out.resize(tableStart + table.size() * sizeof(Entry));
+
+	for (size_t i = 0; i < sorted.size(); i++) {
+		//Trees are already stored flat, so their arrays are written as is
+		RegionTreeView view = sorted.at(i)->getRegionView();
+		Pos_t pos = sorted.at(i)->getBox().min;
+		table.at(i) = {pos.x, pos.y, pos.z, 0, 0, (uint32_t) view.getNodeCount(), (uint32_t) view.size()};
+
+		alignTo(out);
+		table.at(i).nodeOffset = out.size();
+		append(out, view.getNodes(), view.getNodeCount() * sizeof(RegionNode));
+
+		alignTo(out);
+		table.at(i).regionOffset = out.size();
+		append(out, view.getRegions(), view.size() * sizeof(InternalRegion));
+	}
+
+	std::memcpy(&out.at(0) + tableStart, table.data(), table.size() * sizeof(Entry));
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write((const char*) out.data(), out.size());
+
+	if (!file) {
+		throw std::runtime_error("Failed to write chunk archive \"" + path + "\"!");
+	}
+}
+
+ChunkArchive::ChunkArchive(const std::string& path, const unsigned char* data, size_t length) :
+	path(path),
+	data(data),
+	length(length),
+	entries(nullptr),
+	chunkCount(0) {
+
+}
+
+ChunkArchive::~ChunkArchive() {
+	munmap((void*) data, length);
+}
+
+const ChunkArchive::Entry* ChunkArchive::findEntry(const Pos_t& pos) const {
+	const Entry* end = entries + chunkCount;
+	const Entry* entry = std::lower_bound(entries, end, pos, [](const Entry& e, const Pos_t& p) {
+		return std::tie(e.x, e.y, e.z) < std::tie(p.x, p.y, p.z);
+	});
+
+	if (entry == end || entry->x != pos.x || entry->y != pos.y || entry->z != pos.z) {
+		return nullptr;
+	}
+
+	return entry;
+}
+
+std::shared_ptr<Chunk> ChunkArchive::loadChunk(const Pos_t& pos) {
+	const Entry* entry = findEntry(pos);
+
+	if (!entry) {
+		return nullptr;
+	}
+
+	//Checked against the file length before any array is touched
+	if (entry->nodeOffset % arrayAlign != 0 || entry->regionOffset % arrayAlign != 0 ||
+		entry->nodeOffset > length || entry->nodeCount > (length - entry->nodeOffset) / sizeof(RegionNode) ||
+		entry->regionOffset > length || entry->regionCount > (length - entry->regionOffset) / sizeof(InternalRegion)) {
+
+		throw std::runtime_error("Corrupt chunk in archive \"" + path + "\"!");
+	}
+
+	RegionTreeView view((const RegionNode*) (data + entry->nodeOffset), entry->nodeCount,
+						(const InternalRegion*) (data + entry->regionOffset), entry->regionCount);
+
+	if (!view.validate()) {
+		throw std::runtime_error("Corrupt chunk in archive \"" + path + "\"!");
+	}
+
+	//Chunks share ownership of the archive, keeping it mapped while they use it
+	return std::make_shared<Chunk>(Aabb<int64_t>(pos, pos + Pos_t(256, 256, 256)), view, shared_from_this());
+}
@@ -0,0 +1,111 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Chunk.hpp"
+
+/**
+ * A read-only file of pre-generated chunks which is memory mapped instead of
+ * read. Chunks are stored as flattened region trees in the same layout used in
+ * memory, so loading one only validates the arrays and points a RegionTreeView
+ * at them. The archive stays mapped until every chunk using it is edited or
+ * unloaded.
+ * Archives are written in the native byte order and refuse to open otherwise.
+ */
+class ChunkArchive : public std::enable_shared_from_this<ChunkArchive> {
+public:
+	/**
+	 * Maps the archive at the given path.
+	 * @param path The archive file.
+	 * @return The archive, or nullptr if the file doesn't exist.
+	 * @throw std::runtime_error if the file isn't a valid archive.
+	 */
+	static std::shared_ptr<ChunkArchive> open(const std::string& path);
+
+	/**
+	 * Writes the given chunks to a new archive, replacing any existing file.
+	 * @param path The file to write.
+	 * @param chunks The chunks to store.
+	 */
+	static void write(const std::string& path, const std::vector<std::shared_ptr<Chunk>>& chunks);
+
+	/**
+	 * Unmaps the archive.
+	 */
+	~ChunkArchive();
+
+	/**
+	 * Loads a chunk from the archive without copying its regions.
+	 * @param pos The position of the chunk, as passed to ChunkBuilder.
+	 * @return The chunk, or nullptr if it isn't in the archive.
+	 */
+	std::shared_ptr<Chunk> loadChunk(const Pos_t& pos);
+
+	/**
+	 * Checks whether a chunk is in the archive, without loading it.
+	 * @param pos The position of the chunk, as passed to ChunkBuilder.
+	 * @return Whether the chunk is stored.
+	 */
+	bool hasChunk(const Pos_t& pos) const { return findEntry(pos) != nullptr; }
+
+	/**
+	 * Gets the number of chunks in the archive.
+	 * @return The number of stored chunks.
+	 */
+	size_t size() const { return chunkCount; }
+
+private:
+	//Location of a chunk's arrays in the file, stored sorted by position.
+	struct Entry {
+		int64_t x;
+		int64_t y;
+		int64_t z;
+		uint64_t nodeOffset;
+		uint64_t regionOffset;
+		uint32_t nodeCount;
+		uint32_t regionCount;
+	};
+
+	//Path to the file, for error messages.
+	std::string path;
+	//Start of the mapping.
+	const unsigned char* data;
+	//Length of the mapping.
+	size_t length;
+	//Sorted table of stored chunks, inside the mapping.
+	const Entry* entries;
+	//Number of entries.
+	size_t chunkCount;
+
+	/**
+	 * Finds a chunk's entry in the table.
+	 * @param pos The position of the chunk.
+	 * @return The entry, or nullptr if the chunk isn't stored.
+	 */
+	const Entry* findEntry(const Pos_t& pos) const;
+
+	/**
+	 * Use open() instead.
+	 */
+	ChunkArchive(const std::string& path, const unsigned char* data, size_t length);
+};
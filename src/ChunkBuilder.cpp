@@ -16,6 +16,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  ******************************************************************************/
 
+#include <algorithm>
+
 #include "ChunkBuilder.hpp"
 
 void ChunkBuilder::addRegion(const Region& reg) {
@@ -37,35 +39,159 @@ void ChunkBuilder::addRegion(const Region& reg) {
 		.box = Aabb<uint8_t>(min, max),
 	};
 
-	std::vector<InternalRegion>& regions = sortedRegions[region.type];
-
-	for (size_t i = 0; i < regions.size(); i++) {
-		InternalRegion testReg = regions.at(i);
-
-		Aabb<uint64_t> box1(testReg.box);
-		Aabb<uint64_t> box2(region.box);
+	sortedRegions[region.type].push_back(region);
+}
 
-		box1.max += 1;
-		box2.max += 1;
+void ChunkBuilder::addHeightmap(const std::vector<uint16_t>& heights, const std::vector<uint16_t>& stoneHeights, uint16_t stoneType, uint16_t surfaceType) {
+	constexpr size_t area = 256 * 256;
 
-		if (box1.formsBoxWith(box2) && testReg.type == region.type) {
-			region.box = Aabb<uint8_t>(testReg.box, region.box);
-			regions.at(i) = regions.back();
-			regions.pop_back();
-			i = -1;
-		}
+	if (heights.size() != area || stoneHeights.size() != area) {
+		throw std::invalid_argument("Heightmap is not the size of a chunk!");
 	}
 
-	regions.push_back(region);
+	std::vector<uint16_t> ground(area, 0);
+
+	addColumnLayer(ground, stoneHeights, stoneType);
+	addColumnLayer(stoneHeights, heights, surfaceType);
 }
 
 std::shared_ptr<Chunk> ChunkBuilder::genChunk() const {
-	//Concatenate all region lists
+	//Merge and concatenate all region lists
 	std::vector<InternalRegion> regions;
 
 	for (const auto& regs : sortedRegions) {
-		regions.insert(regions.end(), regs.second.begin(), regs.second.end());
+		std::vector<InternalRegion> merged = regs.second;
+		coalesceRegions(merged);
+
+		regions.insert(regions.end(), merged.begin(), merged.end());
 	}
 
 	return std::make_shared<Chunk>(box, regions);
 }
+
+void ChunkBuilder::addColumnLayer(const std::vector<uint16_t>& bottoms, const std::vector<uint16_t>& tops, uint16_t type) {
+	constexpr size_t length = 256;
+
+	std::vector<InternalRegion>& regions = sortedRegions[type];
+	std::vector<bool> used(length * length, false);
+
+	auto sameColumn = [&](size_t first, size_t second) {
+		return !used.at(second) && bottoms.at(first) == bottoms.at(second) && tops.at(first) == tops.at(second);
+	};
+
+	for (size_t x = 0; x < length; x++) {
+		for (size_t z = 0; z < length; z++) {
+			size_t start = x * length + z;
+
+			if (used.at(start) || bottoms.at(start) >= tops.at(start)) {
+				continue;
+			}
+
+			//Grow along z as far as possible, then along x while every
+			//column in the z run still matches
+			size_t zEnd = z + 1;
+
+			while (zEnd < length && sameColumn(start, x * length + zEnd)) {
+				zEnd++;
+			}
+
+			size_t xEnd = x + 1;
+
+			while (xEnd < length) {
+				bool rowMatches = true;
+
+				for (size_t i = z; i < zEnd && rowMatches; i++) {
+					rowMatches = sameColumn(start, xEnd * length + i);
+				}
+
+				if (!rowMatches) {
+					break;
+				}
+
+				xEnd++;
+			}
+
+			for (size_t i = x; i < xEnd; i++) {
+				std::fill(used.begin() + i * length + z, used.begin() + i * length + zEnd, true);
+			}
+
+			Pos_t min(x, bottoms.at(start), z);
+			Pos_t max(xEnd - 1, tops.at(start) - 1, zEnd - 1);
+
+			regions.push_back({type, Aabb<uint8_t>(min, max)});
+		}
+	}
+}
+
+void ChunkBuilder::coalesceRegions(std::vector<InternalRegion>& regions) {
+	//Merging along one axis can make new merges possible along the others,
+	//so keep sweeping until a full pass over all three axes changes nothing
+	size_t unchangedAxes = 0;
+	size_t axis = 0;
+
+	while (unchangedAxes < 3) {
+		if (sweepAxis(regions, axis)) {
+			unchangedAxes = 1;
+		}
+		else {
+			unchangedAxes++;
+		}
+
+		axis = (axis + 1) % 3;
+	}
+}
+
+bool ChunkBuilder::sweepAxis(std::vector<InternalRegion>& regions, size_t axis) {
+	if (regions.size() < 2) {
+		return false;
+	}
+
+	const size_t axis1 = (axis + 1) % 3;
+	const size_t axis2 = (axis + 2) % 3;
+
+	//Packs the face shared by two mergeable regions into the upper bits, and
+	//the region's position along the merge axis into the lower bits
+	auto sortKey = [&](const InternalRegion& reg) -> uint64_t {
+		return ((uint64_t)reg.box.min[axis1] << 32) |
+			   ((uint64_t)reg.box.max[axis1] << 24) |
+			   ((uint64_t)reg.box.min[axis2] << 16) |
+			   ((uint64_t)reg.box.max[axis2] << 8) |
+			   (uint64_t)reg.box.min[axis];
+	};
+
+	//Keys are computed once up front, as the comparisons dominate the sort
+	std::vector<std::pair<uint64_t, InternalRegion>> keyed;
+	keyed.reserve(regions.size());
+
+	for (const InternalRegion& reg : regions) {
+		keyed.emplace_back(sortKey(reg), reg);
+	}
+
+	std::sort(keyed.begin(), keyed.end(), [](const auto& left, const auto& right) {
+		return left.first < right.first;
+	});
+
+	//Since regions don't overlap, the only region that can continue a run
+	//is the one directly after it in sorted order
+	size_t last = 0;
+	bool merged = false;
+	regions.at(0) = keyed.at(0).second;
+
+	for (size_t i = 1; i < keyed.size(); i++) {
+		const InternalRegion& reg = keyed.at(i).second;
+		InternalRegion& run = regions.at(last);
+
+		if ((keyed.at(i - 1).first >> 8) == (keyed.at(i).first >> 8) && (uint64_t)run.box.max[axis] + 1 == reg.box.min[axis]) {
+			run.box.max[axis] = reg.box.max[axis];
+			merged = true;
+		}
+		else {
+			last++;
+			regions.at(last) = reg;
+		}
+	}
+
+	regions.resize(last + 1);
+
+	return merged;
+}
@@ -31,11 +31,26 @@ public:
 	ChunkBuilder(Pos_t pos) : box(pos, pos + Pos_t(256, 256, 256)) {}
 
 	/**
-	 * Queues a region to be added to the generated chunk.
+	 * Queues a region to be added to the generated chunk. Regions are only
+	 * merged together when the chunk is generated.
 	 * @param reg The region to add.
 	 */
 	void addRegion(const Region& reg);
 
+	/**
+	 * Adds heightmap terrain to the chunk. Every column is filled with stone
+	 * from the bottom of the chunk up to its stone height, and with the
+	 * surface type from there up to its height. Columns are merged into boxes
+	 * directly, and skip the validation done in addRegion.
+	 * @param heights The height of each column, relative to the bottom of the
+	 *     chunk. Indexed as x * 256 + z.
+	 * @param stoneHeights The height of the stone in each column, indexed the
+	 *     same as heights. Should not be greater than the column's height.
+	 * @param stoneType The type of the lower part of each column.
+	 * @param surfaceType The type of the upper part of each column.
+	 */
+	void addHeightmap(const std::vector<uint16_t>& heights, const std::vector<uint16_t>& stoneHeights, uint16_t stoneType, uint16_t surfaceType);
+
 	/**
 	 * Gets the chunk's bounding box.
 	 * @return The bounding box for the chunk.
@@ -43,14 +58,43 @@ public:
 	const Aabb<int64_t>& getBox() const { return box; }
 
 	/**
-	 * Generates the chunk.
+	 * Generates the chunk, merging all queued regions of the same type
+	 * into as few boxes as possible.
 	 * @return The generated chunk.
 	 */
 	std::shared_ptr<Chunk> genChunk() const;
 
 private:
-	//Sorts regions by type, for hopefully faster chunk optimization.
+	//Sorts regions by type, as regions of different types can never be merged.
 	std::unordered_map<uint16_t, std::vector<InternalRegion>> sortedRegions;
 	//Chunk bounding box.
 	Aabb<int64_t> box;
+
+	/**
+	 * Adds a layer of columns, each spanning from its bottom to its top
+	 * height, as boxes. Neighboring columns with the same bottom and top are
+	 * merged greedily into rectangles in the xz plane.
+	 * @param bottoms The bottom of each column, inclusive.
+	 * @param tops The top of each column, exclusive.
+	 * @param type The type of the columns.
+	 */
+	void addColumnLayer(const std::vector<uint16_t>& bottoms, const std::vector<uint16_t>& tops, uint16_t type);
+
+	/**
+	 * Merges regions which form a box with another region until no more
+	 * merges are possible. All regions are assumed to be the same type and
+	 * to not overlap.
+	 * @param regions The regions to merge.
+	 */
+	static void coalesceRegions(std::vector<InternalRegion>& regions);
+
+	/**
+	 * Sorts the regions so that regions with the same extents in the other
+	 * two axes are next to each other, ordered along the given axis, then
+	 * joins all adjacent runs in a single sweep.
+	 * @param regions The regions to merge.
+	 * @param axis The axis to merge along.
+	 * @return Whether any regions were merged.
+	 */
+	static bool sweepAxis(std::vector<InternalRegion>& regions, size_t axis);
 };
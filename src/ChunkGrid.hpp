@@ -0,0 +1,227 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+#include "ChunkPos.hpp"
+
+/**
+ * Maps chunk positions to values, using a grid of slots which wraps around
+ * in every direction. Each chunk goes in the slot at its chunk coordinates
+ * modulo the grid's length, so any box of chunks smaller than the grid is
+ * stored without collisions no matter where it is, and moving the box only
+ * reuses the slots of the chunks it left behind. Chunks whose slot is taken
+ * by another chunk, like ones around a second distant loader, are kept in
+ * a hash map by slot instead.
+ */
+template<typename T>
+class ChunkGrid {
+public:
+	//Length of the grid in chunks, as a power of two.
+	static constexpr size_t defaultLengthBits = 5;
+
+	/**
+	 * Creates an empty grid.
+	 * @param lengthBits The length of the grid in chunks, as a power of two.
+	 */
+	ChunkGrid(size_t lengthBits = defaultLengthBits) :
+		lengthBits(lengthBits),
+		mask((1 << lengthBits) - 1),
+		slots((size_t) 1 << (3 * lengthBits)),
+		count(0),
+		outlierTotal(0) {}
+
+	/**
+	 * Finds the value for a chunk.
+	 * @param pos The minimum corner of the chunk.
+	 * @return The chunk's value, or nullptr if it isn't in the grid.
+	 */
+	T* find(const Pos_t& pos) {
+		Slot& slot = slots[slotFor(pos)];
+
+		if (slot.used && slot.pos == pos) {
+			return &slot.value;
+		}
+
+		return outliers.empty() ? nullptr : findOutlier(pos);
+	}
+
+	const T* find(const Pos_t& pos) const {
+		return const_cast<ChunkGrid*>(this)->find(pos);
+	}
+
+	/**
+	 * Checks whether a chunk has a value in the grid.
+	 * @param pos The minimum corner of the chunk.
+	 * @return Whether the chunk is in the grid.
+	 */
+	bool contains(const Pos_t& pos) const { return find(pos) != nullptr; }
+
+	/**
+	 * Gets the value for a chunk, adding a default value if there isn't one.
+	 * @param pos The minimum corner of the chunk.
+	 * @return The chunk's value.
+	 */
+	T& operator[](const Pos_t& pos) {
+		T* value = find(pos);
+
+		if (value) {
+			return *value;
+		}
+
+		count++;
+		Slot& slot = slots[slotFor(pos)];
+
+		if (!slot.used) {
+			slot = {pos, T(), true};
+			return slot.value;
+		}
+
+		std::vector<Slot>& waiting = outliers[slotFor(pos)];
+		waiting.push_back({pos, T(), true});
+		outlierTotal++;
+
+		return waiting.back().value;
+	}
+
+	/**
+	 * Removes a chunk's value from the grid.
+	 * @param pos The minimum corner of the chunk.
+	 * @return Whether the chunk was in the grid.
+	 */
+	bool erase(const Pos_t& pos) {
+		size_t index = slotFor(pos);
+		Slot& slot = slots[index];
+
+		if (slot.used && slot.pos == pos) {
+			slot = {Pos_t(), T(), false};
+			count--;
+
+			//Move a chunk waiting for the slot into it, to keep the map small
+			auto waiting = outliers.find(index);
+
+			if (waiting != outliers.end()) {
+				slot = std::move(waiting->second.back());
+				removeOutlier(waiting, waiting->second.size() - 1);
+			}
+
+			return true;
+		}
+
+		auto waiting = outliers.find(index);
+
+		if (waiting == outliers.end()) {
+			return false;
+		}
+
+		for (size_t i = 0; i < waiting->second.size(); i++) {
+			if (waiting->second.at(i).pos == pos) {
+				removeOutlier(waiting, i);
+				count--;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Gets the number of chunks in the grid.
+	 * @return The number of chunks.
+	 */
+	size_t size() const { return count; }
+
+	/**
+	 * Gets the number of chunks which didn't fit in their slots.
+	 * @return The number of chunks in the fallback map.
+	 */
+	size_t outlierCount() const { return outlierTotal; }
+
+private:
+	struct Slot {
+		Pos_t pos;
+		T value;
+		bool used;
+	};
+
+	size_t lengthBits;
+	//Masks chunk coordinates to the grid's length.
+	int64_t mask;
+	std::vector<Slot> slots;
+	//Chunks whose slots were already taken when they were added, by slot.
+	std::unordered_map<size_t, std::vector<Slot>> outliers;
+	size_t count;
+	//Number of chunks in outliers.
+	size_t outlierTotal;
+
+	/**
+	 * Gets the slot a chunk goes in.
+	 * @param pos The minimum corner of the chunk.
+	 * @return The index of the slot.
+	 */
+	size_t slotFor(const Pos_t& pos) const {
+		//Masking wraps negative coordinates around as well
+		size_t x = (pos.x >> 8) & mask;
+		size_t y = (pos.y >> 8) & mask;
+		size_t z = (pos.z >> 8) & mask;
+
+		return (((x << lengthBits) | y) << lengthBits) | z;
+	}
+
+	/**
+	 * Finds the value for a chunk in the fallback map.
+	 * @param pos The minimum corner of the chunk.
+	 * @return The chunk's value, or nullptr if it isn't in the map.
+	 */
+	T* findOutlier(const Pos_t& pos) {
+		auto waiting = outliers.find(slotFor(pos));
+
+		if (waiting == outliers.end()) {
+			return nullptr;
+		}
+
+		for (Slot& outlier : waiting->second) {
+			if (outlier.pos == pos) {
+				return &outlier.value;
+			}
+		}
+
+		return nullptr;
+	}
+
+	/**
+	 * Removes a chunk from the fallback map.
+	 * @param waiting The chunks waiting for the chunk's slot.
+	 * @param index The index of the chunk in waiting.
+	 */
+	void removeOutlier(typename std::unordered_map<size_t, std::vector<Slot>>::iterator waiting, size_t index) {
+		if (index + 1 < waiting->second.size()) {
+			waiting->second.at(index) = std::move(waiting->second.back());
+		}
+
+		waiting->second.pop_back();
+		outlierTotal--;
+
+		if (waiting->second.empty()) {
+			outliers.erase(waiting);
+		}
+	}
+};
@@ -17,26 +17,137 @@
  ******************************************************************************/
 
 #include <stack>
+#include <algorithm>
+#include <limits>
+#include <chrono>
 
 #include "ChunkLoader.hpp"
 #include "ChunkBuilder.hpp"
 #include "Perlin.hpp"
 #include "ScreenComponents.hpp"
+#include "Display/Camera.hpp"
 #include "Names.hpp"
 
+namespace {
+	//Offsets to the neighboring chunks for each face normal, in the same order as RegionFace.
+	const std::array<Pos_t, 6> neighborOffsets = {
+		Pos_t(0, 0, -256), Pos_t(256, 0, 0), Pos_t(0, 0, 256), Pos_t(-256, 0, 0), Pos_t(0, 256, 0), Pos_t(0, -256, 0)
+	};
+	//The neighbor's side facing back towards the chunk, for each face normal.
+	const std::array<size_t, 6> oppositeSides = {2, 3, 0, 1, 5, 4};
+
+	/**
+	 * Calls a function for every position in a box.
+	 * @param box The box, with inclusive bounds.
+	 * @param fn The function to call, taking a const Pos_t&.
+	 */
+	template<typename Func>
+	void forEachIn(const Aabb<int64_t>& box, Func fn) {
+		for (int64_t x = box.min.x; x <= box.max.x; x++) {
+			for (int64_t y = box.min.y; y <= box.max.y; y++) {
+				for (int64_t z = box.min.z; z <= box.max.z; z++) {
+					fn(Pos_t(x, y, z));
+				}
+			}
+		}
+	}
+
+	/**
+	 * Calls a function for every position in a box which isn't in another
+	 * box, without visiting the positions they share.
+	 * @param box The box to visit, with inclusive bounds.
+	 * @param exclude The box to skip, with inclusive bounds.
+	 * @param fn The function to call, taking a const Pos_t&.
+	 */
+	template<typename Func>
+	void forEachOutside(const Aabb<int64_t>& box, const Aabb<int64_t>& exclude, Func fn) {
+		Aabb<int64_t> remaining = box;
+
+		//Peel off the slabs below and above the excluded box on each axis,
+		//leaving only the overlap, which is skipped
+		for (size_t axis = 0; axis < 3; axis++) {
+			if (remaining.max[axis] < exclude.min[axis] || remaining.min[axis] > exclude.max[axis]) {
+				forEachIn(remaining, fn);
+				return;
+			}
+
+			if (remaining.min[axis] < exclude.min[axis]) {
+				Aabb<int64_t> slab = remaining;
+				slab.max[axis] = exclude.min[axis] - 1;
+				forEachIn(slab, fn);
+				remaining.min[axis] = exclude.min[axis];
+			}
+
+			if (remaining.max[axis] > exclude.max[axis]) {
+				Aabb<int64_t> slab = remaining;
+				slab.min[axis] = exclude.max[axis] + 1;
+				forEachIn(slab, fn);
+				remaining.max[axis] = exclude.max[axis];
+			}
+		}
+	}
+}
+
+ChunkLoader::~ChunkLoader() {
+	for (const std::shared_ptr<Chunk>& chunk : loadedChunks) {
+		if (!chunk->isSaved()) {
+			store.queueSave(*chunk);
+		}
+	}
+
+	//Also writes chunks unloaded recently, or which failed to write before
+	store.flushPending();
+}
+
+size_t ChunkLoader::exportArchive(const std::string& path, const Aabb<int64_t>& area) {
+	ChunkStore exportStore(storeDirectory);
+	std::vector<std::shared_ptr<Chunk>> chunks;
+
+	forEachIn(area, [&](const Pos_t& chunkCoords) {
+		Pos_t pos = chunkCoords * 256l;
+		std::shared_ptr<Chunk> chunk = exportStore.loadChunk(pos);
+		bool solid;
+		uint16_t type;
+
+		if (!chunk) {
+			//Would be created by loadUniformChunk instead of read from the archive
+			if (isUniformChunk(pos, solid, type)) {
+				return;
+			}
+
+			chunk = genChunk(pos);
+		}
+
+		chunks.push_back(chunk);
+	});
+
+	ChunkArchive::write(path, chunks);
+
+	return chunks.size();
+}
+
 void ChunkLoader::update(Screen* screen) {
-	//Add generated chunks to world
-	std::shared_ptr<Chunk> chunk;
+	//Add generated chunks and meshes to the world, spreading them over
+	//several ticks if there are too many to add at once
+	double addStart = ExMath::getTimeMillis();
+	MeshedChunk meshed;
 
-	while (completeChunks.try_pop(chunk)) {
-		addChunk(screen, chunk);
+	while (completeChunks.try_pop(meshed)) {
+		finishMesh(screen, std::move(meshed));
+
+		if (ExMath::getTimeMillis() - addStart > meshAddBudget) {
+			break;
+		}
 	}
 
 	//Queue up new chunks for generation
+	loaderAreas.clear();
+
 	for (size_t i = 0; i < chunkLoaders.size(); i++) {
 		std::shared_ptr<Object> loader = chunkLoaders.at(i).loader.lock();
 
 		if (!loader) {
+			releaseTickets(chunkLoaders.at(i));
 			chunkLoaders.at(i) = chunkLoaders.back();
 			chunkLoaders.pop_back();
 			i--;
@@ -57,90 +168,49 @@ void ChunkLoader::update(Screen* screen) {
 		int64_t loadRadius = chunkLoaders.at(i).prefRange;
 		Aabb<int64_t> loadBox(centerChunk - loadRadius, centerChunk + loadRadius);
 
-		size_t missingCrit = 0;
-
-		//Add critical chunks first
-		for (int64_t x = critBox.min.x; x <= critBox.max.x; x++) {
-			for (int64_t y = critBox.min.y; y <= critBox.max.y; y++) {
-				for (int64_t z = critBox.min.z; z <= critBox.max.z; z++) {
-					Pos_t chunkPos(x, y, -z);
-					chunkPos *= 256l;
+		loaderAreas.push_back({pos, critBox});
 
-					if (!chunkMap.count(chunkPos)) {
-						chunkMap.emplace(chunkPos, std::shared_ptr<Chunk>());
-						dispatchChunkGen(chunkPos);
-					}
-
-					//Determine number of unloaded critical chunks
-					if (!chunkMap.at(chunkPos)) {
-						missingCrit++;
-					}
-				}
-			}
-		}
+		//Only chunks entering or leaving the loader's range need to be
+		//visited, and nothing changes unless it crossed into another chunk
+		Aabb<int64_t> ticketBox(critBox, loadBox);
+		LoaderObj& loaderObj = chunkLoaders.at(i);
 
-		//Then add less important chunks
-		for (int64_t x = loadBox.min.x; x <= loadBox.max.x; x++) {
-			for (int64_t y = loadBox.min.y; y <= loadBox.max.y; y++) {
-				for (int64_t z = loadBox.min.z; z <= loadBox.max.z; z++) {
-					Pos_t chunkPos(x, y, -z);
-					chunkPos *= 256l;
-
-					if (!chunkMap.count(chunkPos)) {
-						chunkMap.emplace(chunkPos, std::shared_ptr<Chunk>());
-						dispatchChunkGen(chunkPos);
-					}
-					else if (chunkMap.at(chunkPos)) {
-						//Chunk already exists, so update its "last required to be loaded" timer
-						chunkMap.at(chunkPos)->loadTimer = tick;
-					}
-				}
-			}
+		if (!loaderObj.hasTickets || loaderObj.ticketBox.min != ticketBox.min || loaderObj.ticketBox.max != ticketBox.max) {
+			moveTickets(screen, loaderObj, ticketBox, critBox, pos);
 		}
 
 		//Wait until all critical chunks are loaded
-		while (missingCrit > 0) {
-			if (!completeChunks.try_pop(chunk)) {
-				continue;
-			}
-
-			Pos_t chunkPos = chunk->getBox().min;
-			Pos_t chunkCoords = chunkPos / 256l;
-			chunkCoords.z = -chunkCoords.z;
-
-			if (critBox.contains(Aabb<int64_t>(chunkCoords, chunkCoords))) {
-				missingCrit--;
-			}
-
-			addChunk(screen, chunk);
+		if (loaderObj.missingCrit > 0) {
+			waitForCritical(screen, loaderObj);
 		}
 	}
 
-	//Unload all chunks which have not been needed for the last 120 ticks (currently 2 seconds)
-	for (size_t i = 0; i < loadedChunks.size(); i++) {
-		std::shared_ptr<Chunk> chunk = loadedChunks.at(i);
+	prioritizeGen(screen);
 
-		if (tick - chunk->loadTimer > 120) {
-			Pos_t chunkPos = chunk->getBox().min;
+	//Remesh chunks which were edited since their last mesh was made,
+	//or which have new neighbors to cull their edges against
+	std::vector<Pos_t> checks;
+	checks.swap(remeshChecks);
 
-			if (chunk->getObject()) {
-				screen->removeObject(chunk->getObject());
-			}
+	for (const Pos_t& chunkPos : checks) {
+		std::shared_ptr<Chunk>* chunk = chunkMap.find(chunkPos);
 
-			if (!chunkMap.count(chunkPos)) {
-				throw std::runtime_error("Bad map entry!\n");
-			}
-
-			chunkMap.erase(chunkPos);
-			loadedChunks.at(i) = loadedChunks.back();
-			loadedChunks.pop_back();
-			i--;
-
-			//TODO: save chunk to disk
+		//Chunks being meshed are checked again once their mesh is done
+		if (chunk && *chunk && !meshingChunks.count(chunk->get()) && (*chunk)->needsRemesh(getNeighbors(chunkPos))) {
+			remeshChunk(*chunk);
 		}
 	}
 
-	tick++;
+	evictChunks(screen);
+}
+
+void ChunkLoader::printStats() {
+	std::cout << "Critical chunk stalls: " << stallStats.stalls << " (" << stallStats.timeouts << " timed out), " <<
+		stallStats.totalMillis << "ms total, " << stallStats.maxMillis << "ms max, " << stallStats.helpedJobs << " jobs run while waiting\n";
+	std::cout << "Chunk cache: " << loadedChunks.size() << " chunks (" << evictionOrder.size() << " unneeded), " <<
+		cacheBytes << " / " << cacheBudget << " bytes\n";
+
+	Chunk::printMeshStats();
 }
 
 std::shared_ptr<Chunk> ChunkLoader::getChunk(glm::vec3 pos) {
@@ -151,33 +221,624 @@ std::shared_ptr<Chunk> ChunkLoader::getChunk(glm::vec3 pos) {
 	if (pos.z > 0) truncPos.z -= 256l;
 	truncPos = (truncPos / 256l) * 256l;
 
-	if (chunkMap.count(truncPos)) {
-		return chunkMap.at(truncPos);
+	std::shared_ptr<Chunk>* chunk = chunkMap.find(truncPos);
+
+	if (chunk) {
+		return *chunk;
 	}
 
 	return std::shared_ptr<Chunk>();
 }
 
-void ChunkLoader::addChunk(Screen* screen, std::shared_ptr<Chunk> chunk) {
+std::shared_ptr<Chunk> ChunkLoader::getChunkForBlock(const Pos_t& pos) {
+	std::shared_ptr<Chunk>* chunk = chunkMap.find(chunkPosFor(pos));
+
+	if (chunk) {
+		return *chunk;
+	}
+
+	return std::shared_ptr<Chunk>();
+}
+
+bool ChunkLoader::raycast(glm::vec3 start, glm::vec3 end, BlockHit& hit) {
+	//Block coordinates have z flipped compared to the world
+	glm::vec3 origin(start.x, start.y, -start.z);
+	glm::vec3 dir(end.x - start.x, end.y - start.y, start.z - end.z);
+
+	//Step through the chunks the segment passes, in the same way a
+	//voxel traversal steps through blocks
+	Pos_t chunkPos = chunkPosFor(Pos_t(glm::floor(origin)));
+	Pos_t step;
+	glm::vec3 nextDist;
+	glm::vec3 stepDist;
+
+	for (size_t axis = 0; axis < 3; axis++) {
+		if (dir[axis] > 0.0f) {
+			step[axis] = 256;
+			nextDist[axis] = (chunkPos[axis] + 256 - origin[axis]) / dir[axis];
+			stepDist[axis] = 256.0f / dir[axis];
+		}
+		else if (dir[axis] < 0.0f) {
+			step[axis] = -256;
+			nextDist[axis] = (chunkPos[axis] - origin[axis]) / dir[axis];
+			stepDist[axis] = -256.0f / dir[axis];
+		}
+		else {
+			step[axis] = 0;
+			nextDist[axis] = std::numeric_limits<float>::infinity();
+			stepDist[axis] = std::numeric_limits<float>::infinity();
+		}
+	}
+
+	float chunkStart = 0.0f;
+
+	while (chunkStart <= 1.0f) {
+		size_t exitAxis = 0;
+
+		for (size_t axis = 1; axis < 3; axis++) {
+			exitAxis = nextDist[axis] < nextDist[exitAxis] ? axis : exitAxis;
+		}
+
+		float chunkEnd = std::min(nextDist[exitAxis], 1.0f);
+		std::shared_ptr<Chunk>* chunk = chunkMap.find(chunkPos);
+
+		if (chunk && *chunk && (*chunk)->raycast(origin, dir, chunkStart, chunkEnd, hit)) {
+			return true;
+		}
+
+		chunkStart = nextDist[exitAxis];
+		chunkPos[exitAxis] += step[exitAxis];
+		nextDist[exitAxis] += stepDist[exitAxis];
+	}
+
+	return false;
+}
+
+void ChunkLoader::fillBox(const Aabb<int64_t>& box, uint16_t type) {
+	editChunks(box, [&](Chunk& chunk, const Aabb<int64_t>& part) {
+		chunk.fillBox(part, type);
+	});
+}
+
+void ChunkLoader::clearBox(const Aabb<int64_t>& box) {
+	editChunks(box, [&](Chunk& chunk, const Aabb<int64_t>& part) {
+		chunk.clearBox(part);
+	});
+}
+
+void ChunkLoader::moveTickets(Screen* screen, LoaderObj& loader, const Aabb<int64_t>& ticketBox, const Aabb<int64_t>& critBox, const glm::vec3& loaderPos) {
+	//Take the new tickets before releasing the old ones, so chunks in both
+	//boxes never lose their last ticket
+	auto take = [&](const Pos_t& coords) {
+		Pos_t chunkPos(coords.x, coords.y, -coords.z);
+		chunkPos *= 256l;
+
+		if (tickets[chunkPos]++ > 0) {
+			return;
+		}
+
+		CacheEntry* entry = cacheEntries.find(chunkPos);
+
+		if (entry) {
+			//Loaded but unneeded, so keep it from being unloaded
+			evictionOrder.erase(entry->evictionIter);
+			entry->evictable = false;
+		}
+		else if (!chunkMap.contains(chunkPos)) {
+			std::shared_ptr<Chunk> uniform = loadUniformChunk(chunkPos);
+
+			//Uniform chunks are cheap enough to add right away, and start
+			//without a mesh, since they only have faces next to other chunks
+			if (uniform) {
+				addChunk(screen, uniform, {"", {}, {}, 0});
+			}
+			else {
+				chunkMap[chunkPos] = std::shared_ptr<Chunk>();
+				dispatchChunkGen(chunkPos, critBox.contains(Aabb<int64_t>(coords, coords)), loaderPos);
+			}
+		}
+	};
+
+	auto isMissing = [&](const Pos_t& coords) {
+		std::shared_ptr<Chunk>* chunk = chunkMap.find(Pos_t(coords.x, coords.y, -coords.z) * 256l);
+		return !chunk || !*chunk;
+	};
+
+	//Only chunks entering or leaving the critical box change the count.
+	//Counted before taking tickets, as uniform chunks are added right away.
+	bool hadTickets = loader.hasTickets;
+
+	if (hadTickets) {
+		forEachOutside(loader.critBox, critBox, [&](const Pos_t& coords) {
+			loader.missingCrit -= isMissing(coords);
+		});
+
+		forEachOutside(critBox, loader.critBox, [&](const Pos_t& coords) {
+			loader.missingCrit += isMissing(coords);
+		});
+	}
+	else {
+		loader.missingCrit = 0;
+
+		forEachIn(critBox, [&](const Pos_t& coords) {
+			loader.missingCrit += isMissing(coords);
+		});
+	}
+
+	//Set before taking tickets, so addChunk counts the uniform chunks added
+	//by take against the new box
+	loader.hasTickets = true;
+	loader.critBox = critBox;
+
+	if (hadTickets) {
+		forEachOutside(ticketBox, loader.ticketBox, take);
+		forEachOutside(loader.ticketBox, ticketBox, [&](const Pos_t& coords) {
+			releaseTicket(coords);
+		});
+	}
+	else {
+		forEachIn(ticketBox, take);
+	}
+
+	loader.ticketBox = ticketBox;
+}
+
+void ChunkLoader::releaseTicket(const Pos_t& coords) {
+	Pos_t chunkPos(coords.x, coords.y, -coords.z);
+	chunkPos *= 256l;
+
+	uint32_t* ticketCount = tickets.find(chunkPos);
+
+	if (!ticketCount) {
+		throw std::runtime_error("Released missing chunk ticket!");
+	}
+
+	if (--*ticketCount > 0) {
+		return;
+	}
+
+	tickets.erase(chunkPos);
+
+	//Chunks still being generated are cancelled by prioritizeGen instead
+	if (cacheEntries.contains(chunkPos)) {
+		makeEvictable(chunkPos);
+	}
+}
+
+void ChunkLoader::releaseTickets(LoaderObj& loader) {
+	if (!loader.hasTickets) {
+		return;
+	}
+
+	forEachIn(loader.ticketBox, [&](const Pos_t& coords) {
+		releaseTicket(coords);
+	});
+
+	loader.hasTickets = false;
+}
+
+void ChunkLoader::addChunk(Screen* screen, std::shared_ptr<Chunk> chunk, ChunkMeshData&& mesh) {
 	Pos_t chunkPos = chunk->getBox().min;
 
-	if (chunk->regionCount() != 0) {
-		chunk->createObject();
+	chunk->createObject(std::move(mesh));
+
+	if (chunk->getObject()) {
 		screen->addObject(chunk->getObject());
 	}
 
-	chunk->loadTimer = tick;
+	size_t memUsage = chunk->getMemUsage() + chunk->getMeshMemUsage();
+
+	cacheEntries[chunkPos] = {memUsage, loadedChunks.size(), false, evictionOrder.end()};
+	cacheBytes += memUsage;
 	loadedChunks.push_back(chunk);
 	chunkMap[chunkPos] = chunk;
+
+	//The chunk can arrive after every loader moved away from it
+	if (!tickets.contains(chunkPos)) {
+		makeEvictable(chunkPos);
+	}
+
+	queueRemeshChecks(chunkPos);
+
+	Pos_t chunkCoords = chunkPos / 256l;
+	chunkCoords.z = -chunkCoords.z;
+
+	for (LoaderObj& loader : chunkLoaders) {
+		if (loader.hasTickets && loader.critBox.contains(Aabb<int64_t>(chunkCoords, chunkCoords))) {
+			loader.missingCrit--;
+		}
+	}
+}
+
+void ChunkLoader::makeEvictable(const Pos_t& chunkPos) {
+	CacheEntry& entry = *cacheEntries.find(chunkPos);
+
+	entry.evictable = true;
+	entry.evictionIter = evictionOrder.insert(evictionOrder.end(), chunkPos);
+}
+
+void ChunkLoader::updateMemUsage(const Chunk& chunk) {
+	CacheEntry& entry = *cacheEntries.find(chunk.getBox().min);
+
+	cacheBytes -= entry.memUsage;
+	entry.memUsage = chunk.getMemUsage() + chunk.getMeshMemUsage();
+	cacheBytes += entry.memUsage;
+}
+
+void ChunkLoader::evictChunks(Screen* screen) {
+	while (cacheBytes > cacheBudget && !evictionOrder.empty()) {
+		//Copied, since unloading removes it from the list
+		Pos_t chunkPos = evictionOrder.front();
+		unloadChunk(screen, chunkPos);
+	}
+}
+
+void ChunkLoader::unloadChunk(Screen* screen, const Pos_t& chunkPos) {
+	CacheEntry* entry = cacheEntries.find(chunkPos);
+	std::shared_ptr<Chunk>* chunkSlot = chunkMap.find(chunkPos);
+
+	if (!entry || !chunkSlot || !*chunkSlot) {
+		throw std::runtime_error("Bad map entry!\n");
+	}
+
+	std::shared_ptr<Chunk> chunk = *chunkSlot;
+
+	if (chunk->getObject()) {
+		screen->removeObject(chunk->getObject());
+		chunk->releaseObject();
+	}
+
+	if (!chunk->isSaved()) {
+		store.queueSave(*chunk);
+
+		runAsyncJob([&, chunkPos]() {
+			//The chunk stays queued if the write fails, so it can still be
+			//loaded and is written again by flushPending
+			try {
+				store.writePending(chunkPos);
+			}
+			catch (const std::runtime_error& e) {
+				std::cout << "Couldn't save chunk: " << e.what() << "\n";
+			}
+		});
+	}
+
+	if (entry->evictable) {
+		evictionOrder.erase(entry->evictionIter);
+	}
+
+	//Move the last loaded chunk into the unloaded one's place
+	size_t index = entry->loadedIndex;
+	loadedChunks.at(index) = loadedChunks.back();
+	loadedChunks.pop_back();
+
+	if (index < loadedChunks.size()) {
+		cacheEntries.find(loadedChunks.at(index)->getBox().min)->loadedIndex = index;
+	}
+
+	cacheBytes -= entry->memUsage;
+	cacheEntries.erase(chunkPos);
+	chunkMap.erase(chunkPos);
 }
 
-void ChunkLoader::dispatchChunkGen(const Pos_t& pos) {
-	Engine::runAsync([&, pos]() {
-		std::shared_ptr<Chunk> chunk = genChunk(pos);
-		completeChunks.push(chunk);
+void ChunkLoader::remeshChunk(std::shared_ptr<Chunk> chunk) {
+	ChunkNeighbors neighbors = getNeighbors(chunk->getBox().min);
+	meshingChunks.insert(chunk.get());
+
+	runAsyncJob([&, chunk, neighbors]() {
+		pushComplete({chunk, chunk->generateMesh(neighbors), true});
 	});
 }
 
+void ChunkLoader::queueRemeshChecks(const Pos_t& chunkPos) {
+	remeshChecks.push_back(chunkPos);
+
+	//The neighbors' edges may be culled against the chunk
+	for (const Pos_t& offset : neighborOffsets) {
+		remeshChecks.push_back(chunkPos + offset);
+	}
+}
+
+void ChunkLoader::editChunks(const Aabb<int64_t>& box, std::function<void(Chunk&, const Aabb<int64_t>&)> edit) {
+	Pos_t minChunk = chunkPosFor(box.min);
+	Pos_t maxChunk = chunkPosFor(box.max - Pos_t(1, 1, 1));
+
+	for (int64_t x = minChunk.x; x <= maxChunk.x; x += 256) {
+		for (int64_t y = minChunk.y; y <= maxChunk.y; y += 256) {
+			for (int64_t z = minChunk.z; z <= maxChunk.z; z += 256) {
+				Pos_t chunkPos(x, y, z);
+				std::shared_ptr<Chunk>* chunk = chunkMap.find(chunkPos);
+
+				if (!chunk || !*chunk) {
+					continue;
+				}
+
+				Aabb<int64_t> chunkBox = (*chunk)->getBox();
+				Aabb<int64_t> part = box;
+
+				for (size_t axis = 0; axis < 3; axis++) {
+					part.min[axis] = std::max(part.min[axis], chunkBox.min[axis]);
+					part.max[axis] = std::min(part.max[axis], chunkBox.max[axis]);
+				}
+
+				edit(**chunk, part);
+				queueRemeshChecks(chunkPos);
+			}
+		}
+	}
+}
+
+void ChunkLoader::runAsyncJob(std::function<void()> job) {
+	pendingJobs.push(std::move(job));
+
+	//Whichever task gets to run first takes the oldest job, and tasks
+	//find nothing to do if the update thread took their job already
+	Engine::runAsync([&]() {
+		runPendingJob();
+	});
+}
+
+bool ChunkLoader::runPendingJob() {
+	std::function<void()> job;
+
+	if (pendingJobs.try_pop(job)) {
+		job();
+		return true;
+	}
+
+	GenRequest request;
+
+	{
+		std::lock_guard<std::mutex> lock(genMutex);
+
+		if (genQueue.empty()) {
+			return false;
+		}
+
+		std::pop_heap(genQueue.begin(), genQueue.end());
+		request = std::move(genQueue.back());
+		genQueue.pop_back();
+	}
+
+	runGenRequest(request);
+	return true;
+}
+
+void ChunkLoader::pushComplete(MeshedChunk&& meshed) {
+	completeChunks.push(std::move(meshed));
+
+	//Taking the lock makes sure the update thread is either already waiting
+	//or hasn't checked the queue yet, so the notification can't be missed
+	{
+		std::lock_guard<std::mutex> lock(completeMutex);
+	}
+
+	completeCondition.notify_one();
+}
+
+void ChunkLoader::waitForCritical(Screen* screen, const LoaderObj& loader) {
+	double start = ExMath::getTimeMillis();
+	MeshedChunk meshed;
+
+	//Adding chunks lowers the loader's count
+	while (loader.missingCrit > 0) {
+		double remaining = critWaitTimeout - (ExMath::getTimeMillis() - start);
+
+		if (remaining <= 0.0) {
+			stallStats.timeouts++;
+			break;
+		}
+
+		if (!completeChunks.try_pop(meshed)) {
+			//Help with pending work instead of idling
+			if (runPendingJob()) {
+				stallStats.helpedJobs++;
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(completeMutex);
+			completeCondition.wait_for(lock, std::chrono::duration<double, std::milli>(remaining), [&]() {
+				return !completeChunks.empty();
+			});
+
+			continue;
+		}
+
+		finishMesh(screen, std::move(meshed));
+	}
+
+	double stalled = ExMath::getTimeMillis() - start;
+
+	stallStats.stalls++;
+	stallStats.totalMillis += stalled;
+	stallStats.maxMillis = std::max(stallStats.maxMillis, stalled);
+}
+
+void ChunkLoader::finishMesh(Screen* screen, MeshedChunk&& meshed) {
+	if (!meshed.remesh) {
+		addChunk(screen, meshed.chunk, std::move(meshed.mesh));
+		return;
+	}
+
+	meshingChunks.erase(meshed.chunk.get());
+	std::shared_ptr<Chunk>* chunk = chunkMap.find(meshed.chunk->getBox().min);
+
+	//The chunk was unloaded while its mesh was being generated
+	if (!chunk || *chunk != meshed.chunk) {
+		return;
+	}
+
+	if (meshed.chunk->getObject()) {
+		screen->removeObject(meshed.chunk->getObject());
+	}
+
+	meshed.chunk->createObject(std::move(meshed.mesh));
+	updateMemUsage(*meshed.chunk);
+
+	if (meshed.chunk->getObject()) {
+		screen->addObject(meshed.chunk->getObject());
+	}
+
+	//Catches edits and new neighbors from while the mesh was being made
+	remeshChecks.push_back(meshed.chunk->getBox().min);
+}
+
+ChunkNeighbors ChunkLoader::getNeighbors(const Pos_t& chunkPos) {
+	ChunkNeighbors neighbors;
+
+	for (size_t normal = 0; normal < neighborOffsets.size(); normal++) {
+		std::shared_ptr<Chunk>* chunk = chunkMap.find(chunkPos + neighborOffsets.at(normal));
+
+		if (chunk && *chunk) {
+			neighbors.at(normal) = (*chunk)->getBoundary(oppositeSides.at(normal));
+		}
+	}
+
+	return neighbors;
+}
+
+void ChunkLoader::dispatchChunkGen(const Pos_t& pos, bool critical, const glm::vec3& loaderPos) {
+	glm::vec3 center(pos.x + 128, pos.y + 128, -(pos.z + 128));
+
+	{
+		std::lock_guard<std::mutex> lock(genMutex);
+
+		//Neighbors which are already loaded can be culled against right away
+		genQueue.push_back({pos, getNeighbors(pos), critical, glm::length(center - loaderPos) / 256.0f});
+		std::push_heap(genQueue.begin(), genQueue.end());
+	}
+
+	Engine::runAsync([&]() {
+		runPendingJob();
+	});
+}
+
+void ChunkLoader::prioritizeGen(Screen* screen) {
+	std::shared_ptr<Camera> camera = screen->getCamera();
+	glm::vec3 cameraPos(0.0f, 0.0f, 0.0f);
+	glm::vec3 cameraDir(0.0f, 0.0f, 0.0f);
+
+	if (camera) {
+		glm::mat4 invView = glm::inverse(camera->getView());
+		cameraPos = glm::vec3(invView[3]);
+		cameraDir = -glm::normalize(glm::vec3(invView[2]));
+	}
+
+	std::vector<Pos_t> cancelled;
+
+	{
+		std::lock_guard<std::mutex> lock(genMutex);
+
+		for (size_t i = 0; i < genQueue.size(); i++) {
+			GenRequest& request = genQueue.at(i);
+			Pos_t chunkCoords = request.pos / 256l;
+			chunkCoords.z = -chunkCoords.z;
+			Aabb<int64_t> coordBox(chunkCoords, chunkCoords);
+
+			glm::vec3 center(request.pos.x + 128, request.pos.y + 128, -(request.pos.z + 128));
+
+			//Nobody needs the chunk anymore, so don't bother generating it
+			if (!tickets.contains(request.pos)) {
+				cancelled.push_back(request.pos);
+				genQueue.at(i) = std::move(genQueue.back());
+				genQueue.pop_back();
+				i--;
+				continue;
+			}
+
+			request.critical = false;
+			request.distance = std::numeric_limits<float>::max();
+
+			for (const LoaderArea& area : loaderAreas) {
+				request.critical = request.critical || area.critBox.contains(coordBox);
+				request.distance = std::min(request.distance, glm::length(center - area.pos) / 256.0f);
+			}
+
+			if (camera) {
+				float facing = glm::dot(glm::normalize(center - cameraPos), cameraDir);
+				request.distance *= 1.0f + facingWeight * (1.0f - facing);
+			}
+		}
+
+		std::make_heap(genQueue.begin(), genQueue.end());
+	}
+
+	//Let the chunks be requested again if a loader comes back
+	for (const Pos_t& pos : cancelled) {
+		chunkMap.erase(pos);
+	}
+}
+
+void ChunkLoader::runGenRequest(const GenRequest& request) {
+	std::shared_ptr<Chunk> chunk;
+
+	//Unreadable chunks are generated again rather than stopping the game
+	try {
+		//Also caches the region file's table, so loadUniformChunk can check its
+		//neighbors without reading the file on the update thread
+		if (store.hasChunk(request.pos)) {
+			chunk = store.loadChunk(request.pos);
+		}
+	}
+	catch (const std::runtime_error& e) {
+		std::cout << "Couldn't load saved chunk, generating it instead: " << e.what() << "\n";
+	}
+
+	//Saved chunks are newer than archived ones
+	try {
+		if (!chunk && archive) {
+			chunk = archive->loadChunk(request.pos);
+		}
+	}
+	catch (const std::runtime_error& e) {
+		std::cout << "Couldn't load archived chunk, generating it instead: " << e.what() << "\n";
+	}
+
+	if (!chunk) {
+		bool solid;
+		uint16_t type;
+
+		//Meshed once all their neighbors are loaded, like in moveTickets
+		if (isUniformChunk(request.pos, solid, type)) {
+			chunk = Chunk::createUniform(Aabb<int64_t>(request.pos, request.pos + Pos_t(256, 256, 256)), solid, type);
+			pushComplete({chunk, {"", {}, {}, 0}, false});
+			return;
+		}
+
+		chunk = genChunk(request.pos);
+	}
+
+	pushComplete({chunk, chunk->generateMesh(request.neighbors), false});
+}
+
+bool ChunkLoader::isUniformChunk(const Pos_t& pos, bool& solid, uint16_t& type) {
+	//Ground - anything below 0 is underground
+	if (pos.y + 256 <= 0) {
+		solid = true;
+		type = 1;
+		return true;
+	}
+
+	//Only the layer from 0 to 256 has terrain, everything above is sky
+	solid = false;
+	return pos.y != 0;
+}
+
+std::shared_ptr<Chunk> ChunkLoader::loadUniformChunk(const Pos_t& pos) {
+	bool solid;
+	uint16_t type;
+	bool stored;
+
+	//Saved and archived chunks can be different from what would be generated.
+	//Region tables which aren't cached yet are read by runGenRequest instead,
+	//off the update thread.
+	if (!isUniformChunk(pos, solid, type) || !store.checkCached(pos, stored) || stored || (archive && archive->hasChunk(pos))) {
+		return nullptr;
+	}
+
+	return Chunk::createUniform(Aabb<int64_t>(pos, pos + Pos_t(256, 256, 256)), solid, type);
+}
+
 std::shared_ptr<Chunk> ChunkLoader::genChunk(const Pos_t& pos) {
 #if 0
 	ChunkBuilder chunk(pos);
@@ -218,31 +879,32 @@ std::shared_ptr<Chunk> ChunkLoader::genChunk(const Pos_t& pos) {
 
 	ChunkBuilder chunk(pos);
 	Aabb<int64_t> chunkBox = chunk.getBox();
+	bool solid;
+	uint16_t type;
 
-	//Ground - anything below 0 is underground
-	if (chunkBox.max.y <= 0) {
-		Aabb<int64_t> groundBox = chunkBox;
-
-		chunk.addRegion({1, groundBox});
+	//Underground and sky chunks
+	if (isUniformChunk(pos, solid, type)) {
+		return Chunk::createUniform(chunkBox, solid, type);
 	}
 
 	//Add layer of dirt and stone for terrain
-	else if (chunkBox.max.y <= 256 && chunkBox.min.y >= 0) {
-		for (int64_t i = pos.x; i < chunkBox.max.x; i++) {
-			for (int64_t j = pos.z; j < chunkBox.max.z; j++) {
-				float heightPercent = perlin2DOctaves({i, j}, 8, 512, std::hash<std::string>()(seed));
-				int64_t height = (int64_t) (heightPercent * 255) + pos.y;
-				int64_t stoneHeight = pos.y + height / 2;
-
-				if (stoneHeight > 0) {
-					chunk.addRegion({1, Aabb<int64_t>({i, 0, j}, {i+1, stoneHeight, j+1})});
-				}
-
-				chunk.addRegion({0, Aabb<int64_t>({i, stoneHeight, j}, {i+1, height, j+1})});
-			}
+	std::vector<uint16_t> heights(256 * 256, 0);
+	std::vector<uint16_t> stoneHeights(256 * 256, 0);
+
+	for (int64_t i = pos.x; i < chunkBox.max.x; i++) {
+		for (int64_t j = pos.z; j < chunkBox.max.z; j++) {
+			float heightPercent = perlin2DOctaves({i, j}, 8, 512, std::hash<std::string>()(seed));
+			int64_t height = (int64_t) (heightPercent * 255) + pos.y;
+			int64_t stoneHeight = pos.y + height / 2;
+
+			size_t index = (i - pos.x) * 256 + (j - pos.z);
+			heights.at(index) = std::max<int64_t>(0, std::min<int64_t>(height - pos.y, 256));
+			stoneHeights.at(index) = std::max<int64_t>(0, std::min<int64_t>(stoneHeight - pos.y, heights.at(index)));
 		}
 	}
 
+	chunk.addHeightmap(heights, stoneHeights, 1, 0);
+
 	return chunk.genChunk();
 #endif
 }
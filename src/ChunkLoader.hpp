@@ -20,16 +20,82 @@
 
 #include <memory>
 #include <vector>
-#include <unordered_map>
+#include <list>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
 
 #include <tbb/concurrent_queue.h>
 
 #include "Components/UpdateComponent.hpp"
 #include "Chunk.hpp"
+#include "ChunkGrid.hpp"
+#include "ChunkStore.hpp"
+#include "ChunkArchive.hpp"
 
 class ChunkLoader : public UpdateComponent {
 public:
-	ChunkLoader() : tick(0) {}
+	//Time per tick spent adding finished meshes to the screen, in milliseconds.
+	//At least one mesh is added every tick.
+	static constexpr double meshAddBudget = 2.0;
+	//Longest time the update thread waits for critical chunks each tick, in
+	//milliseconds. Chunks still missing after this are waited for next tick.
+	static constexpr double critWaitTimeout = 1000.0;
+	//How much farther away chunks behind the camera are treated as being when
+	//deciding which chunks to generate first. Chunks in front are treated as
+	//their actual distance, and chunks directly behind as 1 + 2 * facingWeight
+	//times their distance.
+	static constexpr float facingWeight = 0.5f;
+	//Default memory budget for loaded chunks and their meshes, in bytes.
+	static constexpr size_t defaultCacheBudget = 512 * 1024 * 1024;
+	//Directory chunks are saved to when unloaded.
+	static constexpr const char* storeDirectory = "world";
+	//Pre-generated chunks, loaded instead of generating them if present.
+	static constexpr const char* archivePath = "world.vxa";
+
+	//How long the update thread was stalled waiting for critical chunks.
+	struct StallStats {
+		//Ticks which had to wait for critical chunks.
+		size_t stalls;
+		//Waits which gave up before every critical chunk was loaded.
+		size_t timeouts;
+		//Jobs run by the update thread itself while waiting.
+		size_t helpedJobs;
+		double totalMillis;
+		double maxMillis;
+	};
+
+	/**
+	 * Creates a chunk loader.
+	 * @param cacheBudget How much memory loaded chunks can use, in bytes.
+	 *     Chunks no loader needs are kept until the budget is used up, while
+	 *     chunks in range of a loader are kept regardless of the budget.
+	 */
+	ChunkLoader(size_t cacheBudget = defaultCacheBudget) :
+		cacheBytes(0),
+		cacheBudget(cacheBudget),
+		stallStats{},
+		store(storeDirectory),
+		archive(ChunkArchive::open(archivePath)) {}
+
+	/**
+	 * Saves every loaded chunk which was changed, and finishes writing
+	 * chunks which were unloaded, so no edits are lost.
+	 */
+	~ChunkLoader();
+
+	/**
+	 * Writes a chunk archive containing the chunks in an area, so they don't
+	 * have to be generated while playing. Saved chunks are taken from the
+	 * store, and the rest are generated. Unsaved uniform chunks are left out,
+	 * as they're created without generation anyway.
+	 * @param path Where to write the archive.
+	 * @param area The chunks to export, in chunk coordinates (block
+	 *     coordinates divided by 256).
+	 * @return The number of chunks written.
+	 */
+	static size_t exportArchive(const std::string& path, const Aabb<int64_t>& area);
 
 	/**
 	 * Refreshes which chunks should be loaded, unloads uneeded chunks,
@@ -45,9 +111,29 @@ public:
 	 * @param prefDist The range of chunks which should be loaded for gameplay smoothness.
 	 */
 	void addLoader(std::shared_ptr<Object> object, uint64_t critDist, uint64_t prefDist) {
-		chunkLoaders.push_back({object, critDist, prefDist});
+		chunkLoaders.push_back({object, critDist, prefDist, false, Aabb<int64_t>(), Aabb<int64_t>(), 0});
 	}
 
+	/**
+	 * Gets how long the update thread has spent waiting for critical chunks.
+	 * @return The stall statistics since the loader was created.
+	 */
+	const StallStats& getStallStats() const { return stallStats; }
+
+	/**
+	 * Sets how much memory loaded chunks can use. Chunks over the budget are
+	 * unloaded during the next update.
+	 * @param budget The budget, in bytes.
+	 */
+	void setCacheBudget(size_t budget) { cacheBudget = budget; }
+
+	/**
+	 * Prints how long the update thread has spent waiting for critical
+	 * chunks, how much memory loaded chunks are using, and the stats shared
+	 * by all chunk meshes.
+	 */
+	void printStats();
+
 	/**
 	 * Returns the chunk the given position is inside, preferring the chunk farther
 	 * from zero if on a border.
@@ -56,47 +142,377 @@ public:
 	 */
 	std::shared_ptr<Chunk> getChunk(glm::vec3 pos);
 
-private:
-	struct PosHash {
-		size_t operator()(const Pos_t& pos) const noexcept {
-			uint64_t x = pos.x;
-			uint64_t y = pos.y;
-			uint64_t z = pos.z;
-			return (((x >> 1) ^ y) << 1) ^ z;
+	/**
+	 * Returns the chunk containing the given block.
+	 * @param pos The position of the block, in world block coordinates.
+	 * @return The chunk containing the block, or nullptr if none is loaded.
+	 */
+	std::shared_ptr<Chunk> getChunkForBlock(const Pos_t& pos);
+
+	/**
+	 * Gets the type of the block at the given position.
+	 * @param pos The position of the block, in world block coordinates.
+	 * @param type Set to the block's type, if there is a block.
+	 * @return Whether there is a block at the position. Blocks in chunks
+	 *     which aren't loaded are treated as empty.
+	 */
+	bool getBlock(const Pos_t& pos, uint16_t& type) {
+		std::shared_ptr<Chunk> chunk = getChunkForBlock(pos);
+		return chunk && chunk->getBlock(pos, type);
+	}
+
+	/**
+	 * Finds the first block hit by a line segment, walking through loaded
+	 * chunks in order along the segment. Unloaded chunks are treated as empty.
+	 * @param start The start of the segment, in world (render) coordinates.
+	 * @param end The end of the segment, in world (render) coordinates.
+	 * @param hit Set to the hit block, in world block coordinates. The
+	 *     distance is a fraction of the segment's length.
+	 * @return Whether a block was hit.
+	 */
+	bool raycast(glm::vec3 start, glm::vec3 end, BlockHit& hit);
+
+	/**
+	 * Fills a box with blocks, in every loaded chunk it overlaps. Parts of
+	 * the box in chunks which aren't loaded are skipped. Must be called from
+	 * the update thread, as the edited chunks are queued for remeshing.
+	 * @param box The box to fill, in world block coordinates.
+	 * @param type The type of block to fill the box with.
+	 */
+	void fillBox(const Aabb<int64_t>& box, uint16_t type);
+
+	/**
+	 * Removes all blocks in a box, in every loaded chunk it overlaps. Same
+	 * as fillBox otherwise.
+	 * @param box The box to clear, in world block coordinates.
+	 */
+	void clearBox(const Aabb<int64_t>& box);
+
+	/**
+	 * Calls a function for every region in a loaded chunk which overlaps the
+	 * given box. Regions are clipped to their chunks, so a region will never
+	 * cross a chunk boundary.
+	 * @param area The box to check, in world block coordinates.
+	 * @param fn The function to call, taking a const Region&.
+	 */
+	template<typename Func>
+	void forEachOverlapping(const Aabb<int64_t>& area, Func fn) {
+		Pos_t minChunk = chunkPosFor(area.min);
+		Pos_t maxChunk = chunkPosFor(area.max - Pos_t(1, 1, 1));
+
+		for (int64_t x = minChunk.x; x <= maxChunk.x; x += 256) {
+			for (int64_t y = minChunk.y; y <= maxChunk.y; y += 256) {
+				for (int64_t z = minChunk.z; z <= maxChunk.z; z += 256) {
+					std::shared_ptr<Chunk>* chunk = chunkMap.find(Pos_t(x, y, z));
+
+					if (chunk && *chunk) {
+						(*chunk)->forEachOverlapping(area, fn);
+					}
+				}
+			}
 		}
+	}
+
+private:
+	//A chunk with a mesh generated for it asynchronously.
+	struct MeshedChunk {
+		std::shared_ptr<Chunk> chunk;
+		ChunkMeshData mesh;
+		//Whether the chunk was already loaded, rather than newly generated.
+		bool remesh;
 	};
 
 	struct LoaderObj {
 		std::weak_ptr<Object> loader;
 		uint64_t critRange;
 		uint64_t prefRange;
+		//Whether the loader holds tickets for the chunks in ticketBox.
+		bool hasTickets;
+		//Every chunk the loader wants loaded as of its last move, in chunk
+		//coordinates with z flipped.
+		Aabb<int64_t> ticketBox;
+		//The chunks in ticketBox which must be loaded.
+		Aabb<int64_t> critBox;
+		//Number of chunks in critBox which aren't loaded yet. Kept up to date
+		//as the loader moves and chunks are added, instead of counting each tick.
+		size_t missingCrit;
 	};
 
-	//Current tick, used for determining which chunks to unload.
-	size_t tick;
-	//All currently loaded chunks, sorted by position.
-	std::unordered_map<Pos_t, std::shared_ptr<Chunk>, PosHash> chunkMap;
+	//The chunks a loader wanted loaded during the current tick.
+	struct LoaderArea {
+		//Position of the loader, in world coordinates.
+		glm::vec3 pos;
+		//Chunks which must be loaded, in chunk coordinates with z flipped.
+		Aabb<int64_t> critBox;
+	};
+
+	//Memory tracking for a loaded chunk.
+	struct CacheEntry {
+		//Bytes used by the chunk and its mesh, as of when its mesh was last replaced.
+		size_t memUsage;
+		//Index of the chunk in loadedChunks.
+		size_t loadedIndex;
+		//Whether no loader needs the chunk, so it can be unloaded.
+		bool evictable;
+		//The chunk's place in evictionOrder, if it's evictable.
+		std::list<Pos_t>::iterator evictionIter;
+	};
+
+	//A chunk waiting to be generated.
+	struct GenRequest {
+		Pos_t pos;
+		//Boundaries of the chunk's neighbors when the request was made.
+		ChunkNeighbors neighbors;
+		//Whether the chunk is in some loader's critical range, which puts
+		//it ahead of every other chunk.
+		bool critical;
+		//Distance from the closest loader in chunks, adjusted for whether
+		//the camera is facing the chunk. Closer chunks are generated first.
+		float distance;
+
+		/**
+		 * Orders requests so the next one to generate is at the top of a heap.
+		 * @param other The request to compare against.
+		 * @return Whether this request should be generated after the other one.
+		 */
+		bool operator<(const GenRequest& other) const {
+			if (critical != other.critical) {
+				return other.critical;
+			}
+
+			return distance > other.distance;
+		}
+	};
+
+	//All currently loaded chunks, by position. Chunks which are still being
+	//generated have null entries.
+	ChunkGrid<std::shared_ptr<Chunk>> chunkMap;
 	//Stores all currently loaded chunks.
 	std::vector<std::shared_ptr<Chunk>> loadedChunks;
+	//Memory tracking for every loaded chunk.
+	ChunkGrid<CacheEntry> cacheEntries;
+	//Chunks no loader needs, from the one which has gone unneeded longest.
+	std::list<Pos_t> evictionOrder;
+	//Total memory used by loaded chunks, in bytes.
+	size_t cacheBytes;
+	//Memory loaded chunks can use before unneeded ones are unloaded, in bytes.
+	size_t cacheBudget;
 	//All objects capable of loading chunks, as well as the radius of the
 	//box they should load.
 	std::vector<LoaderObj> chunkLoaders;
-	//Chunks which have finished generation and can be added to the map.
-	tbb::concurrent_queue<std::shared_ptr<Chunk>> completeChunks;
+	//Where each loader wanted chunks loaded during the current tick.
+	std::vector<LoaderArea> loaderAreas;
+	//Number of loaders which want each chunk loaded, by chunk position.
+	//Chunks without tickets can be unloaded when over the memory budget.
+	ChunkGrid<uint32_t> tickets;
+	//Chunks which have finished generation or remeshing, with their meshes
+	//ready to be added to the screen.
+	tbb::concurrent_queue<MeshedChunk> completeChunks;
+	//Loaded chunks which currently have a mesh being generated.
+	std::unordered_set<const Chunk*> meshingChunks;
+	//Chunks which may need a new mesh, because they or one of their
+	//neighbors were added or edited. Checked and cleared every update.
+	std::vector<Pos_t> remeshChecks;
+	//Meshing jobs which haven't been started yet. Each job, as well as each
+	//generation request, has a matching task given to the engine, but the
+	//update thread can take jobs itself while waiting for critical chunks.
+	tbb::concurrent_queue<std::function<void()>> pendingJobs;
+	//Chunks waiting to be generated, as a heap with the most important
+	//chunk at the top. Guarded by genMutex.
+	std::vector<GenRequest> genQueue;
+	std::mutex genMutex;
+	//Used to wake the update thread when something is added to completeChunks.
+	std::mutex completeMutex;
+	std::condition_variable completeCondition;
+	StallStats stallStats;
+	//Where chunks are saved when unloaded.
+	ChunkStore store;
+	//Pre-generated chunks used before generating new ones, null if there's no archive.
+	std::shared_ptr<ChunkArchive> archive;
+
+	/**
+	 * Gets the position of the chunk containing a block.
+	 * @param pos The block position.
+	 * @return The minimum corner of the chunk.
+	 */
+	static Pos_t chunkPosFor(const Pos_t& pos) {
+		//Rounds down for negative positions as well
+		constexpr int64_t mask = ~(int64_t) 255;
+		return Pos_t(pos.x & mask, pos.y & mask, pos.z & mask);
+	}
+
+	/**
+	 * Updates the tickets held by a loader after it moves, only visiting the
+	 * chunks entering or leaving its range.
+	 * @param screen The screen to add chunks to.
+	 * @param loader The loader.
+	 * @param ticketBox The chunks the loader now wants loaded.
+	 * @param critBox The chunks which must be loaded.
+	 * @param loaderPos The position of the loader.
+	 */
+	void moveTickets(Screen* screen, LoaderObj& loader, const Aabb<int64_t>& ticketBox, const Aabb<int64_t>& critBox, const glm::vec3& loaderPos);
+
+	/**
+	 * Releases one ticket for a chunk. Once its last ticket is released, the
+	 * chunk can be unloaded.
+	 * @param coords The chunk, in chunk coordinates with z flipped.
+	 */
+	void releaseTicket(const Pos_t& coords);
+
+	/**
+	 * Releases every ticket held by a loader.
+	 * @param loader The loader.
+	 */
+	void releaseTickets(LoaderObj& loader);
 
 	/**
 	 * Adds a chunk to the loader's internal data structure, as well as
 	 * the provided screen.
 	 * @param screen The screen to add the chunk to.
 	 * @param chunk The chunk to add to the screen.
+	 * @param mesh The chunk's mesh.
+	 */
+	void addChunk(Screen* screen, std::shared_ptr<Chunk> chunk, ChunkMeshData&& mesh);
+
+	/**
+	 * Lets a loaded chunk be unloaded, after the chunks which became
+	 * unneeded before it.
+	 * @param chunkPos The minimum corner of the chunk.
+	 */
+	void makeEvictable(const Pos_t& chunkPos);
+
+	/**
+	 * Measures the memory used by a loaded chunk again, after its mesh changed.
+	 * @param chunk The chunk.
+	 */
+	void updateMemUsage(const Chunk& chunk);
+
+	/**
+	 * Unloads the chunks which have gone unneeded longest until the loaded
+	 * chunks fit in the memory budget, or no unneeded chunks are left.
+	 * @param screen The screen the chunks were added to.
+	 */
+	void evictChunks(Screen* screen);
+
+	/**
+	 * Removes a chunk from the world, saving it first if it was changed. The
+	 * chunk is serialized right away, but written to disk asynchronously.
+	 * @param screen The screen the chunk was added to.
+	 * @param chunkPos The minimum corner of the chunk.
 	 */
-	void addChunk(Screen* screen, std::shared_ptr<Chunk> chunk);
+	void unloadChunk(Screen* screen, const Pos_t& chunkPos);
 
 	/**
-	 * Function used to asynchronously generate a chunk.
+	 * Asynchronously generates a new mesh for a loaded chunk. The chunk's
+	 * object is replaced once the mesh is finished.
+	 * @param chunk The chunk to remesh.
+	 */
+	void remeshChunk(std::shared_ptr<Chunk> chunk);
+
+	/**
+	 * Queues a chunk and its neighbors to be checked for remeshing, after
+	 * the chunk was added or its blocks changed.
+	 * @param chunkPos The minimum corner of the chunk.
+	 */
+	void queueRemeshChecks(const Pos_t& chunkPos);
+
+	/**
+	 * Applies an edit to each loaded chunk overlapping a box, and queues
+	 * them for remeshing.
+	 * @param box The edited box, in world block coordinates.
+	 * @param edit The function to call, taking the chunk and the part of
+	 *     the box inside it.
+	 */
+	void editChunks(const Aabb<int64_t>& box, std::function<void(Chunk&, const Aabb<int64_t>&)> edit);
+
+	/**
+	 * Gets the boundaries of the loaded chunks next to a chunk.
+	 * @param chunkPos The minimum corner of the chunk.
+	 * @return The neighbors' boundaries, null for neighbors which aren't loaded.
+	 */
+	ChunkNeighbors getNeighbors(const Pos_t& chunkPos);
+
+	/**
+	 * Queues a job to be run asynchronously.
+	 * @param job The job to run.
+	 */
+	void runAsyncJob(std::function<void()> job);
+
+	/**
+	 * Runs one of the jobs which haven't been started yet, if there are any.
+	 * Meshing jobs are run before generating new chunks.
+	 * @return Whether a job was run.
+	 */
+	bool runPendingJob();
+
+	/**
+	 * Adds a chunk or mesh to completeChunks, waking the update thread if
+	 * it's waiting for one.
+	 * @param meshed The finished chunk.
+	 */
+	void pushComplete(MeshedChunk&& meshed);
+
+	/**
+	 * Waits until every critical chunk around a loader is loaded, running
+	 * pending jobs instead of sleeping where possible. Gives up after
+	 * critWaitTimeout milliseconds.
+	 * @param screen The screen to add chunks to.
+	 * @param loader The loader, with its critical chunks already counted.
+	 */
+	void waitForCritical(Screen* screen, const LoaderObj& loader);
+
+	/**
+	 * Adds a newly generated chunk, or replaces a remeshed chunk's object,
+	 * using a mesh generated asynchronously.
+	 * @param screen The screen to add the chunk to.
+	 * @param meshed The chunk and its mesh.
+	 */
+	void finishMesh(Screen* screen, MeshedChunk&& meshed);
+
+	/**
+	 * Queues a chunk to be generated asynchronously, along with its mesh.
+	 * The queue is reordered at the end of every tick.
 	 * @param pos The chunk to generate.
+	 * @param critical Whether the chunk is in a loader's critical range.
+	 * @param loaderPos The position of the loader which wants the chunk.
+	 */
+	void dispatchChunkGen(const Pos_t& pos, bool critical, const glm::vec3& loaderPos);
+
+	/**
+	 * Reorders the chunks waiting to be generated based on where the loaders
+	 * and camera currently are, and cancels chunks which are no longer in
+	 * range of any loader.
+	 * @param screen The screen, for getting the camera.
+	 */
+	void prioritizeGen(Screen* screen);
+
+	/**
+	 * Generates a chunk and its mesh. Chunks which were saved before are
+	 * loaded from disk instead.
+	 * @param request The chunk to generate.
+	 */
+	void runGenRequest(const GenRequest& request);
+
+	/**
+	 * Checks whether genChunk makes a chunk which is completely empty or
+	 * completely filled with one type, based only on its position. Must be
+	 * kept in sync with genChunk.
+	 * @param pos The position of the chunk.
+	 * @param solid Set to whether the chunk is filled rather than empty.
+	 * @param type Set to the type filling the chunk, if it's filled.
+	 * @return Whether the chunk is uniform.
+	 */
+	static bool isUniformChunk(const Pos_t& pos, bool& solid, uint16_t& type);
+
+	/**
+	 * Creates a uniform chunk without going through generation, if the
+	 * chunk would be generated as uniform and was never saved or archived.
+	 * Never reads region files, so chunks whose region table isn't cached
+	 * yet go through generation instead.
+	 * @param pos The position of the chunk.
+	 * @return The chunk, or nullptr if it has to be generated or loaded.
 	 */
-	void dispatchChunkGen(const Pos_t& pos);
+	std::shared_ptr<Chunk> loadUniformChunk(const Pos_t& pos);
 
 	/**
 	 * Temporary function to generate a chunk using the given position.
@@ -104,5 +520,5 @@ private:
 	 *     origin.
 	 * @return The generated chunk.
 	 */
-	std::shared_ptr<Chunk> genChunk(const Pos_t& pos);
+	static std::shared_ptr<Chunk> genChunk(const Pos_t& pos);
 };
@@ -0,0 +1,62 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include <iostream>
+#include <algorithm>
+
+#include "ChunkMeshMemory.hpp"
+#include "Voxex.hpp"
+
+ChunkMeshMemory::Allocation ChunkMeshMemory::allocate(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	stats.liveMeshes++;
+	stats.usedBytes += bytes;
+	stats.peakUsedBytes = std::max(stats.peakUsedBytes, stats.usedBytes);
+
+	return Allocation(this, bytes);
+}
+
+ChunkMeshMemory::Stats ChunkMeshMemory::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void ChunkMeshMemory::printStats() {
+	Stats current = getStats();
+
+	std::cout << name << ": " << current.liveMeshes << " meshes, " << current.usedBytes << " / " << capacity << " bytes used (" <<
+		(100.0 * current.usedBytes / capacity) << "%), peak " << current.peakUsedBytes << " bytes\n";
+}
+
+ChunkMeshMemory& ChunkMeshMemory::getVertexMemory() {
+	static ChunkMeshMemory vertexMemory("Chunk vertex buffer", Voxex::CHUNK_VERTEX_BUFFER_SIZE);
+	return vertexMemory;
+}
+
+ChunkMeshMemory& ChunkMeshMemory::getIndexMemory() {
+	static ChunkMeshMemory indexMemory("Chunk index buffer", Voxex::CHUNK_INDEX_BUFFER_SIZE);
+	return indexMemory;
+}
+
+void ChunkMeshMemory::release(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	stats.liveMeshes--;
+	stats.usedBytes -= bytes;
+}
@@ -0,0 +1,138 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+
+/**
+ * Keeps track of the space chunk meshes use in one of the chunk buffers.
+ * Where meshes go in the buffer is up to the engine, so only the amount of
+ * mesh data is tracked, not how it's laid out. Free lists, fragmentation
+ * stats and compaction would need the game to place meshes itself.
+ */
+class ChunkMeshMemory {
+public:
+	struct Stats {
+		//Number of meshes currently using the buffer.
+		size_t liveMeshes;
+		//Bytes of mesh data in the live meshes.
+		size_t usedBytes;
+		//Highest usedBytes seen.
+		size_t peakUsedBytes;
+	};
+
+	/**
+	 * Space used by one mesh, which is released when destroyed.
+	 */
+	class Allocation {
+	public:
+		Allocation() : memory(nullptr), bytes(0) {}
+		Allocation(ChunkMeshMemory* memory, size_t bytes) :
+			memory(memory),
+			bytes(bytes) {}
+
+		Allocation(Allocation&& other) : memory(other.memory), bytes(other.bytes) {
+			other.memory = nullptr;
+		}
+
+		Allocation& operator=(Allocation&& other) {
+			if (this != &other) {
+				reset();
+				memory = other.memory;
+				bytes = other.bytes;
+				other.memory = nullptr;
+			}
+
+			return *this;
+		}
+
+		~Allocation() { reset(); }
+
+		/**
+		 * Gets the space taken in the buffer.
+		 * @return The allocation's size in bytes, 0 if it was released.
+		 */
+		size_t getSize() const { return memory ? bytes : 0; }
+
+		/**
+		 * Releases the space, if any.
+		 */
+		void reset() {
+			if (memory) {
+				memory->release(bytes);
+				memory = nullptr;
+			}
+		}
+
+	private:
+		ChunkMeshMemory* memory;
+		size_t bytes;
+	};
+
+	/**
+	 * Creates an empty tracker.
+	 * @param name Name printed with the stats.
+	 * @param capacity Size of the buffer, in bytes.
+	 */
+	ChunkMeshMemory(const char* name, size_t capacity) : name(name), capacity(capacity), stats{0, 0, 0} {}
+
+	/**
+	 * Records space for a mesh in the buffer.
+	 * @param bytes The size of the mesh data.
+	 * @return The allocation, which must be kept as long as the mesh is loaded.
+	 */
+	Allocation allocate(size_t bytes);
+
+	/**
+	 * Gets the current usage of the buffer.
+	 * @return The buffer's stats.
+	 */
+	Stats getStats();
+
+	/**
+	 * Prints usage of the buffer.
+	 */
+	void printStats();
+
+	/**
+	 * Gets the tracker for the chunk vertex buffer.
+	 */
+	static ChunkMeshMemory& getVertexMemory();
+
+	/**
+	 * Gets the tracker for the chunk index buffer.
+	 */
+	static ChunkMeshMemory& getIndexMemory();
+
+private:
+	//Name printed with the stats.
+	const char* name;
+	//Size of the buffer, in bytes.
+	size_t capacity;
+	//Guards the stats, as meshes are created and dropped on several threads.
+	std::mutex mutex;
+	//Usage of the buffer.
+	Stats stats;
+
+	/**
+	 * Returns a mesh's space to the buffer.
+	 */
+	void release(size_t bytes);
+};
@@ -0,0 +1,37 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#pragma once
+
+#include "AxisAlignedBB.hpp"
+
+//A position in world block coordinates.
+typedef Aabb<int64_t>::vec_t Pos_t;
+
+/**
+ * Hashes the minimum corners of chunks, for maps keyed by chunk.
+ */
+struct ChunkPosHash {
+	size_t operator()(const Pos_t& pos) const noexcept {
+		//Chunk positions are multiples of 256, so only hash the chunk coordinates
+		uint64_t x = pos.x >> 8;
+		uint64_t y = pos.y >> 8;
+		uint64_t z = pos.z >> 8;
+		return (x * 73856093) ^ (y * 19349663) ^ (z * 83492791);
+	}
+};
@@ -0,0 +1,349 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include <fstream>
+#include <iostream>
+#include <array>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "ChunkStore.hpp"
+#include "ByteOrder.hpp"
+
+namespace {
+	//Identifies region files, and which version of the format they use.
+	constexpr std::array<char, 4> fileMagic = {'V', 'X', 'R', '1'};
+	//Size of a table entry on disk.
+	constexpr size_t entrySize = 12;
+	//Size of the file header, including the table.
+	constexpr size_t headerSize = fileMagic.size() + ChunkStore::fileChunks * entrySize;
+
+	/**
+	 * Rounds towards negative infinity, unlike regular integer division.
+	 */
+	int64_t floorDiv(int64_t val, int64_t div) {
+		return val / div - ((val % div) < 0 ? 1 : 0);
+	}
+
+	/**
+	 * Finds where to put a chunk in a region file. Space left behind by chunks
+	 * which moved is reused if a gap is big enough, so files don't keep
+	 * growing as chunks are edited.
+	 * @param header The file's header, including its table.
+	 * @param skipIndex The table index of the chunk being placed, whose old
+	 *     space is free.
+	 * @param capacity The number of bytes needed.
+	 * @return The offset of the first gap that fits, or the end of the used space.
+	 */
+	uint64_t findSpace(const std::array<unsigned char, headerSize>& header, size_t skipIndex, uint64_t capacity) {
+		std::vector<std::pair<uint64_t, uint64_t>> slots;
+
+		for (size_t i = 0; i < ChunkStore::fileChunks; i++) {
+			const unsigned char* entryData = &header.at(fileMagic.size() + i * entrySize);
+			uint64_t offset = getU32(entryData);
+
+			if (i != skipIndex && offset != 0) {
+				slots.emplace_back(offset, offset + getU32(entryData + 4));
+			}
+		}
+
+		std::sort(slots.begin(), slots.end());
+		uint64_t gapStart = headerSize;
+
+		for (const std::pair<uint64_t, uint64_t>& slot : slots) {
+			if (slot.first >= gapStart + capacity) {
+				return gapStart;
+			}
+
+			gapStart = std::max(gapStart, slot.second);
+		}
+
+		return gapStart;
+	}
+}
+
+ChunkStore::ChunkStore(const std::string& directory) :
+	directory(directory) {
+
+	//Fails harmlessly if the directory already exists
+	mkdir(directory.c_str(), 0755);
+}
+
+void ChunkStore::saveChunk(const Chunk& chunk) {
+	//Goes through the queue, so an older queued version can't be written over it
+	queueSave(chunk);
+	writePending(chunk.getBox().min);
+}
+
+void ChunkStore::queueSave(const Chunk& chunk) {
+	std::shared_ptr<std::vector<unsigned char>> data = std::make_shared<std::vector<unsigned char>>();
+	chunk.serialize(*data);
+
+	std::lock_guard<std::mutex> guard(pendingLock);
+	pendingWrites[chunk.getBox().min] = data;
+}
+
+void ChunkStore::writePending(const Pos_t& pos) {
+	//Holding the file lock throughout makes writes for the same chunk happen
+	//in order, each taking the newest data at the time
+	std::lock_guard<std::mutex> guard(fileLock);
+	std::shared_ptr<const std::vector<unsigned char>> data;
+
+	{
+		std::lock_guard<std::mutex> pendingGuard(pendingLock);
+		auto pending = pendingWrites.find(pos);
+
+		if (pending == pendingWrites.end()) {
+			return;
+		}
+
+		data = pending->second;
+	}
+
+	writeData(pos, *data);
+
+	std::lock_guard<std::mutex> pendingGuard(pendingLock);
+	auto pending = pendingWrites.find(pos);
+
+	//Newer data queued during the write is left for its own writePending
+	if (pending != pendingWrites.end() && pending->second == data) {
+		pendingWrites.erase(pending);
+	}
+}
+
+void ChunkStore::flushPending() {
+	std::vector<Pos_t> positions;
+
+	{
+		std::lock_guard<std::mutex> guard(pendingLock);
+
+		for (const auto& pending : pendingWrites) {
+			positions.push_back(pending.first);
+		}
+	}
+
+	for (const Pos_t& pos : positions) {
+		try {
+			writePending(pos);
+		}
+		catch (const std::runtime_error& e) {
+			std::cout << "Couldn't save chunk: " << e.what() << "\n";
+		}
+	}
+}
+
+void ChunkStore::writeData(const Pos_t& pos, const std::vector<unsigned char>& data) {
+	size_t dataSize = data.size();
+	std::string fileName = getFileName(pos);
+
+	std::fstream file(fileName, std::ios::in | std::ios::out | std::ios::binary);
+	std::array<unsigned char, headerSize> header = {};
+
+	if (file.is_open()) {
+		file.read((char*) header.data(), header.size());
+
+		if (!file || !std::equal(fileMagic.begin(), fileMagic.end(), header.begin())) {
+			throw std::runtime_error("Corrupt region file \"" + fileName + "\"!");
+		}
+	}
+	else {
+		//Create the file with an empty table
+		std::copy(fileMagic.begin(), fileMagic.end(), header.begin());
+
+		std::ofstream create(fileName, std::ios::binary);
+		create.write((const char*) header.data(), header.size());
+		create.close();
+
+		file.open(fileName, std::ios::in | std::ios::out | std::ios::binary);
+
+		if (!file.is_open()) {
+			throw std::runtime_error("Couldn't create region file \"" + fileName + "\"!");
+		}
+	}
+
+	unsigned char* entryData = &header.at(fileMagic.size() + getTableIndex(pos) * entrySize);
+	TableEntry entry = {getU32(entryData), getU32(entryData + 4), getU32(entryData + 8)};
+
+	//Reuse the old space if the chunk still fits, otherwise move it
+	//somewhere with some room to grow
+	if (entry.offset == 0 || entry.capacity < dataSize) {
+		uint64_t capacity = dataSize + dataSize / 4;
+		uint64_t offset = findSpace(header, getTableIndex(pos), capacity);
+
+		//Table entries only hold 32 bit offsets
+		if (offset + capacity > std::numeric_limits<uint32_t>::max()) {
+			throw std::runtime_error("Region file \"" + fileName + "\" is too large!");
+		}
+
+		entry.offset = offset;
+		entry.capacity = capacity;
+
+		std::vector<unsigned char> padding(entry.capacity - dataSize, 0);
+		file.seekp(entry.offset + dataSize);
+		file.write((const char*) padding.data(), padding.size());
+	}
+
+	entry.size = dataSize;
+
+	file.seekp(entry.offset);
+	file.write((const char*) data.data(), data.size());
+
+	putU32(entryData, entry.offset);
+	putU32(entryData + 4, entry.capacity);
+	putU32(entryData + 8, entry.size);
+
+	file.seekp(entryData - header.data());
+	file.write((const char*) entryData, entrySize);
+
+	if (!file) {
+		throw std::runtime_error("Failed to write chunk to \"" + fileName + "\"!");
+	}
+
+	std::lock_guard<std::mutex> tableGuard(tableLock);
+	auto stored = storedChunks.find(fileName);
+
+	if (stored != storedChunks.end()) {
+		stored->second.set(getTableIndex(pos));
+	}
+}
+
+std::shared_ptr<Chunk> ChunkStore::loadChunk(const Pos_t& pos) {
+	std::vector<unsigned char> data;
+	std::shared_ptr<const std::vector<unsigned char>> pendingData;
+
+	{
+		std::lock_guard<std::mutex> guard(pendingLock);
+		auto pending = pendingWrites.find(pos);
+
+		if (pending != pendingWrites.end()) {
+			pendingData = pending->second;
+		}
+	}
+
+	//Chunks which are still queued are newer than the file
+	if (!pendingData) {
+		std::lock_guard<std::mutex> guard(fileLock);
+		std::ifstream file(getFileName(pos), std::ios::binary);
+
+		if (!file.is_open()) {
+			return nullptr;
+		}
+
+		std::array<unsigned char, entrySize> entryData;
+		file.seekg(fileMagic.size() + getTableIndex(pos) * entrySize);
+		file.read((char*) entryData.data(), entryData.size());
+
+		TableEntry entry = {getU32(&entryData.at(0)), getU32(&entryData.at(4)), getU32(&entryData.at(8))};
+
+		if (!file || entry.offset == 0) {
+			return nullptr;
+		}
+
+		data.resize(entry.size);
+		file.seekg(entry.offset);
+		file.read((char*) data.data(), data.size());
+
+		if (!file) {
+			throw std::runtime_error("Truncated region file \"" + getFileName(pos) + "\"!");
+		}
+	}
+
+	const std::vector<unsigned char>& source = pendingData ? *pendingData : data;
+	RegionTree regions;
+
+	if (regions.deserialize(source.data(), source.size()) != source.size()) {
+		throw std::runtime_error("Corrupt chunk in region file \"" + getFileName(pos) + "\"!");
+	}
+
+	std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>(Aabb<int64_t>(pos, pos + Pos_t(256, 256, 256)), std::move(regions));
+	chunk->markSaved();
+
+	return chunk;
+}
+
+bool ChunkStore::hasChunk(const Pos_t& pos) {
+	bool stored;
+
+	if (checkCached(pos, stored)) {
+		return stored;
+	}
+
+	//Held until the table is cached, so a write can't be missed in between
+	std::lock_guard<std::mutex> guard(fileLock);
+	std::string fileName = getFileName(pos);
+	std::bitset<fileChunks> tableBits;
+	std::ifstream file(fileName, std::ios::binary);
+
+	if (file.is_open()) {
+		std::array<unsigned char, headerSize> header;
+		file.read((char*) header.data(), header.size());
+
+		if (!file || !std::equal(fileMagic.begin(), fileMagic.end(), header.begin())) {
+			throw std::runtime_error("Corrupt region file \"" + fileName + "\"!");
+		}
+
+		for (size_t i = 0; i < fileChunks; i++) {
+			tableBits.set(i, getU32(&header.at(fileMagic.size() + i * entrySize)) != 0);
+		}
+	}
+
+	std::lock_guard<std::mutex> tableGuard(tableLock);
+	//Another thread may have cached the table first, which is just as current
+	auto table = storedChunks.emplace(fileName, tableBits).first;
+
+	return table->second.test(getTableIndex(pos));
+}
+
+bool ChunkStore::checkCached(const Pos_t& pos, bool& stored) {
+	{
+		std::lock_guard<std::mutex> guard(pendingLock);
+
+		if (pendingWrites.count(pos)) {
+			stored = true;
+			return true;
+		}
+	}
+
+	std::lock_guard<std::mutex> guard(tableLock);
+	auto table = storedChunks.find(getFileName(pos));
+
+	if (table == storedChunks.end()) {
+		return false;
+	}
+
+	stored = table->second.test(getTableIndex(pos));
+	return true;
+}
+
+std::string ChunkStore::getFileName(const Pos_t& pos) const {
+	int64_t x = floorDiv(pos.x / 256, fileLength);
+	int64_t y = floorDiv(pos.y / 256, fileLength);
+	int64_t z = floorDiv(pos.z / 256, fileLength);
+
+	return directory + "/r." + std::to_string(x) + "." + std::to_string(y) + "." + std::to_string(z) + ".vxr";
+}
+
+size_t ChunkStore::getTableIndex(const Pos_t& pos) const {
+	Pos_t chunkPos = pos / 256l;
+	Pos_t local = chunkPos - fileLength * Pos_t(floorDiv(chunkPos.x, fileLength), floorDiv(chunkPos.y, fileLength), floorDiv(chunkPos.z, fileLength));
+
+	return (local.x * fileLength + local.y) * fileLength + local.z;
+}
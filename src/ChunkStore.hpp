@@ -0,0 +1,152 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <bitset>
+#include <unordered_map>
+
+#include "Chunk.hpp"
+
+/**
+ * Stores chunks on disk, grouped into region files. Each region file holds a
+ * cube of chunks and starts with a table giving the location of every chunk's
+ * data in the file. Chunks are stored as their serialized region trees, so
+ * loading them neither goes through a ChunkBuilder nor rebuilds the tree.
+ */
+class ChunkStore {
+public:
+	//Number of chunks along each axis of a region file.
+	static constexpr int64_t fileLength = 4;
+	//Number of chunks in a region file.
+	static constexpr size_t fileChunks = fileLength * fileLength * fileLength;
+
+	/**
+	 * Creates a chunk store which keeps its region files in the given directory.
+	 * The directory is created if it doesn't exist.
+	 * @param directory The directory to store region files in.
+	 */
+	ChunkStore(const std::string& directory);
+
+	/**
+	 * Writes a chunk to its region file, replacing any previously saved
+	 * version of it.
+	 * @param chunk The chunk to save.
+	 */
+	void saveChunk(const Chunk& chunk);
+
+	/**
+	 * Serializes a chunk to be written later by writePending, so the file
+	 * access can happen on another thread. Until then, the chunk is loaded
+	 * from the queued data.
+	 * @param chunk The chunk to save.
+	 */
+	void queueSave(const Chunk& chunk);
+
+	/**
+	 * Writes the newest queued data for a chunk to its region file. Does
+	 * nothing if the chunk was already written. If the write fails, the data
+	 * stays queued.
+	 * @param pos The position of the chunk.
+	 */
+	void writePending(const Pos_t& pos);
+
+	/**
+	 * Writes every chunk which is still queued. Chunks which fail to write
+	 * are reported and left queued, so one bad region file doesn't stop the
+	 * rest from being saved.
+	 */
+	void flushPending();
+
+	/**
+	 * Loads a previously saved chunk.
+	 * @param pos The position of the chunk, as passed to ChunkBuilder.
+	 * @return The loaded chunk, or nullptr if the chunk was never saved.
+	 */
+	std::shared_ptr<Chunk> loadChunk(const Pos_t& pos);
+
+	/**
+	 * Checks whether a chunk was saved before, without loading it. Each
+	 * region file's table is only read the first time one of its chunks is
+	 * checked.
+	 * @param pos The position of the chunk, as passed to ChunkBuilder.
+	 * @return Whether the chunk was saved.
+	 */
+	bool hasChunk(const Pos_t& pos);
+
+	/**
+	 * Checks whether a chunk was saved before, using only queued writes and
+	 * region tables already read by hasChunk, so it never touches the disk
+	 * or waits on file access.
+	 * @param pos The position of the chunk, as passed to ChunkBuilder.
+	 * @param stored Set to whether the chunk was saved, if it's known.
+	 * @return Whether the answer is known, false if the region file's table
+	 *     hasn't been read yet.
+	 */
+	bool checkCached(const Pos_t& pos, bool& stored);
+
+private:
+	//Location of a chunk in its region file.
+	struct TableEntry {
+		//Offset of the chunk's data in the file, 0 if the chunk isn't stored.
+		uint32_t offset;
+		//Number of bytes that fit at the offset.
+		uint32_t capacity;
+		//Number of bytes actually stored.
+		uint32_t size;
+	};
+
+	//Directory containing the region files.
+	std::string directory;
+	//Serializes file access between the update thread and generation threads.
+	std::mutex fileLock;
+	//Serialized chunks waiting to be written, by position.
+	std::unordered_map<Pos_t, std::shared_ptr<const std::vector<unsigned char>>, ChunkPosHash> pendingWrites;
+	//Guards pendingWrites. Can be taken while holding fileLock, but not the
+	//other way around.
+	std::mutex pendingLock;
+	//Which chunks are stored in each region file checked by hasChunk, by file name.
+	std::unordered_map<std::string, std::bitset<fileChunks>> storedChunks;
+	//Guards storedChunks. Can be taken while holding fileLock, but not the
+	//other way around.
+	std::mutex tableLock;
+
+	/**
+	 * Gets the name of the region file containing the given chunk.
+	 * @param pos The position of the chunk.
+	 * @return The path to the region file.
+	 */
+	std::string getFileName(const Pos_t& pos) const;
+
+	/**
+	 * Gets the index of the given chunk in its region file's table.
+	 * @param pos The position of the chunk.
+	 * @return The table index for the chunk.
+	 */
+	size_t getTableIndex(const Pos_t& pos) const;
+
+	/**
+	 * Writes serialized chunk data to the chunk's region file. fileLock must be held.
+	 * @param pos The position of the chunk.
+	 * @param data The chunk's serialized regions.
+	 */
+	void writeData(const Pos_t& pos, const std::vector<unsigned char>& data);
+};
@@ -16,9 +16,48 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  ******************************************************************************/
 
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
 #include "Voxex.hpp"
+#include "ChunkLoader.hpp"
 
 int main(int argc, char** argv) {
+	//"--export-archive <radius>" pre-generates the chunks within radius chunks
+	//of the spawn into the archive, instead of starting the game
+	if (argc >= 2 && std::string(argv[1]) == "--export-archive") {
+		int64_t radius = -1;
+
+		if (argc == 3) {
+			try {
+				size_t parsed = 0;
+				radius = std::stoll(argv[2], &parsed);
+
+				//Trailing characters make it not a number either
+				if (argv[2][parsed] != '\0') {
+					radius = -1;
+				}
+			}
+			catch (const std::logic_error&) {
+				radius = -1;
+			}
+		}
+
+		if (radius < 0) {
+			std::cout << "Usage: " << argv[0] << " --export-archive <radius>\n";
+			std::cout << "The radius is the number of chunks around the spawn to export, and can't be negative.\n";
+			return 1;
+		}
+
+		Aabb<int64_t> area(Pos_t(-radius, -1, -radius), Pos_t(radius, 1, radius));
+
+		size_t written = ChunkLoader::exportArchive(ChunkLoader::archivePath, area);
+		std::cout << "Wrote " << written << " chunks to " << ChunkLoader::archivePath << "\n";
+
+		return 0;
+	}
+
 	EngineConfig config = {};
 	config.gameName = "Voxex";
 	config.gameVersion = Engine::makeVersion(0, 0, 4);
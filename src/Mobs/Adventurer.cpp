@@ -62,6 +62,14 @@ void Adventurer::update(Screen* screen) {
 
 		std::shared_ptr<PhysicsComponent> physics = getPhysics();
 
+		//The weapon stops at terrain, found without going through the physics
+		//engine. Other mobs still have to be found with it, as they aren't blocks.
+		BlockHit terrainHit;
+
+		if (getChunkLoader()->raycast(physics->getTranslation(), physics->getTranslation() + end, terrainHit)) {
+			end *= terrainHit.distance;
+		}
+
 		std::vector<RaytraceResult> hits = getPhysicsWorld(screen)->raytraceAll(physics->getTranslation(), physics->getTranslation() + end);
 
 		for (RaytraceResult hit : hits) {
@@ -78,7 +86,7 @@ void Adventurer::update(Screen* screen) {
 	}
 }
 
-std::shared_ptr<Object> Adventurer::create() {
+std::shared_ptr<Object> Adventurer::create(std::shared_ptr<ChunkLoader> loader) {
 	std::shared_ptr<Object> adventurer = std::make_shared<Object>();
 
 	PhysicsInfo capsulePhysics = {
@@ -104,7 +112,7 @@ std::shared_ptr<Object> Adventurer::create() {
 
 	//TODO: Control type of input - controlled or AI
 	adventurer->addComponent<PlayerInputComponent>();
-	adventurer->addComponent<Adventurer>();
+	adventurer->addComponent<Adventurer>(loader);
 	adventurer->addComponent<RenderComponent>(PLAYER_MAT, PLAYER_MESH);
 
 	return adventurer;
@@ -24,8 +24,9 @@ class Adventurer : public Mob {
 public:
 	/**
 	 * Creates an adventurer object. Use create instead.
+	 * @param loader The world's chunk loader.
 	 */
-	Adventurer() : Mob() {}
+	Adventurer(std::shared_ptr<ChunkLoader> loader) : Mob(loader) {}
 
 	/**
 	 * Attacks with whatever weapon the adventurer happens to be holding.
@@ -40,7 +41,8 @@ public:
 
 	/**
 	 * Creates a new adventurer object, for adding to the world.
+	 * @param loader The world's chunk loader.
 	 * @return A new adventurer to add to the world.
 	 */
-	static std::shared_ptr<Object> create(/** TODO: Generation parameters go here **/);
+	static std::shared_ptr<Object> create(std::shared_ptr<ChunkLoader> loader/** TODO: Generation parameters go here **/);
 };
@@ -24,15 +24,17 @@ class BoxMonster : public Mob {
 public:
 	/**
 	 * Creates a box monster. Use create instead.
+	 * @param loader The world's chunk loader.
 	 */
-	BoxMonster() : Mob(UpdateState::SLEEPING, ExMath::randomBinomialInt(60, 300, 210)) {}
+	BoxMonster(std::shared_ptr<ChunkLoader> loader) : Mob(loader, UpdateState::SLEEPING, ExMath::randomBinomialInt(60, 300, 210)) {}
 
 	/**
 	 * Creates a new box monster.
 	 * @param pos The position of the box.
+	 * @param loader The world's chunk loader.
 	 * @return The created monster.
 	 */
-	static std::shared_ptr<Object> create(glm::vec3 pos/** TODO: generation parameters **/ ) {
+	static std::shared_ptr<Object> create(glm::vec3 pos, std::shared_ptr<ChunkLoader> loader/** TODO: generation parameters **/ ) {
 		PhysicsInfo boxPhysics = {
 			.shape = PhysicsShape::BOX,
 			.box = Aabb<float>({-0.5, -0.5, -0.5}, {0.5, 0.5, 0.5}),
@@ -43,7 +45,7 @@ public:
 		};
 
 		std::shared_ptr<Object> box = std::make_shared<Object>();
-		box->addComponent<BoxMonster>();
+		box->addComponent<BoxMonster>(loader);
 		box->addComponent<PhysicsComponent>(std::make_shared<PhysicsObject>(boxPhysics));
 
 		return box;
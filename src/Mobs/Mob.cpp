@@ -16,6 +16,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  ******************************************************************************/
 
+#include <cmath>
+
 #include "Mob.hpp"
 
 void Mob::move(glm::vec3 direction) {
@@ -70,11 +72,19 @@ void Mob::update(Screen* screen) {
 
 	glm::vec3 pos = physics->getTranslation();
 
-	bool onGround = world->raytraceSingle(pos, pos - glm::vec3(0.0, 0.876, 0.0)).hitComp != nullptr ||
-					world->raytraceSingle(pos + glm::vec3(-0.25, 0.0, -0.25), pos + glm::vec3(-0.35, -0.78, -0.35)).hitComp != nullptr ||
-					world->raytraceSingle(pos + glm::vec3(0.25, 0.0, 0.25), pos + glm::vec3(0.35, -0.78, 0.35)).hitComp != nullptr ||
-					world->raytraceSingle(pos + glm::vec3(-0.25, 0.0, 0.25), pos + glm::vec3(-0.35, -0.78, 0.35)).hitComp != nullptr ||
-					world->raytraceSingle(pos + glm::vec3(0.25, 0.0, -0.25), pos + glm::vec3(0.35, -0.78, -0.35)).hitComp != nullptr;
+	//Terrain is checked against the chunks directly
+	BlockHit hit;
+	bool onGround = chunkLoader->raycast(pos, pos - glm::vec3(0.0, 0.876, 0.0), hit) ||
+					chunkLoader->raycast(pos + glm::vec3(-0.25, 0.0, -0.25), pos + glm::vec3(-0.35, -0.78, -0.35), hit) ||
+					chunkLoader->raycast(pos + glm::vec3(0.25, 0.0, 0.25), pos + glm::vec3(0.35, -0.78, 0.35), hit) ||
+					chunkLoader->raycast(pos + glm::vec3(-0.25, 0.0, 0.25), pos + glm::vec3(-0.35, -0.78, 0.35), hit) ||
+					chunkLoader->raycast(pos + glm::vec3(0.25, 0.0, -0.25), pos + glm::vec3(0.35, -0.78, -0.35), hit);
+
+	//Only a mob that stopped falling can be standing on another object, so
+	//the physics engine isn't needed while jumping or falling
+	if (!onGround && std::abs(physics->getVelocity().y) < restingSpeed) {
+		onGround = world->raytraceSingle(pos, pos - glm::vec3(0.0, 0.876, 0.0)).hitComp != nullptr;
+	}
 
 	state->flags.set(MobState::Flags::ON_GROUND, onGround);
 
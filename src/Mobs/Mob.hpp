@@ -23,17 +23,24 @@
 #include "Components/UpdateComponent.hpp"
 #include "MobState.hpp"
 #include "Components/PhysicsManager.hpp"
+#include "../ChunkLoader.hpp"
 
 class Mob : public UpdateComponent {
 public:
+	//Vertical speed below which a mob is considered to be resting on something.
+	static constexpr float restingSpeed = 0.1f;
+
 	/**
-	 * Creates a mob. Arguements are the same as those in UpdateComponent.
+	 * Creates a mob. Arguements other than the chunk loader are the same as
+	 * those in UpdateComponent.
+	 * @param loader The world's chunk loader, used to check for terrain.
 	 * @param startingState The state to start in.
 	 * @param startingTime The time to start sleeping for, if starting state is SLEEPING.
 	 * @param concurrent Whether the mob can be updated concurrently.
 	 */
-	Mob(UpdateState startingState = UpdateState::ACTIVE, size_t startingTime = 0, bool concurrent = false) :
+	Mob(std::shared_ptr<ChunkLoader> loader, UpdateState startingState = UpdateState::ACTIVE, size_t startingTime = 0, bool concurrent = false) :
 		UpdateComponent(startingState, startingTime, concurrent),
+		chunkLoader(loader),
 		triedMove(false) {}
 
 	/**
@@ -92,6 +99,12 @@ public:
 		return std::static_pointer_cast<PhysicsManager>(screen->getManager(PHYSICS_COMPONENT_NAME));
 	}
 
+	/**
+	 * Gets the chunk loader for the world the mob is in.
+	 * @return The world's chunk loader.
+	 */
+	std::shared_ptr<ChunkLoader> getChunkLoader() { return chunkLoader; }
+
 	/**
 	 * Updates the object's state.
 	 * @param screen The parent screen.
@@ -99,6 +112,8 @@ public:
 	void update(Screen* screen) override;
 
 private:
+	//The world's chunk loader.
+	std::shared_ptr<ChunkLoader> chunkLoader;
 	//Whether the AI tried to move in the last tick.
 	bool triedMove;
 	//Targeted object.
@@ -18,24 +18,31 @@
 
 #include "MouseHandler.hpp"
 #include "Components/RenderComponent.hpp"
+#include "Display/Camera.hpp"
+#include "Engine.hpp"
 
 void MouseHandler::update(Screen* screen) {
-	std::shared_ptr<PhysicsManager> world = screen->getManager<PhysicsManager>(PHYSICS_COMPONENT_NAME);
+	std::shared_ptr<Camera> camera = screen->getCamera();
+	float width = Engine::instance->getWindowInterface().getWindowWidth();
+	float height = Engine::instance->getWindowInterface().getWindowHeight();
+	glm::vec2 mousePos = screen->getInputMap()->getMousePos();
 
-	RaytraceResult hitObject = world->raytraceUnderMouse();
-	std::shared_ptr<Chunk> hitChunk = chunkLoader->getChunk(hitObject.hitPos);
+	//Unproject the mouse position on the near and far planes to get the ray
+	//under the mouse, which is traced through the chunks without physics
+	glm::mat4 invViewProj = glm::inverse(camera->getProjection() * camera->getView());
+	glm::vec2 ndc(2.0f * mousePos.x / width - 1.0f, 1.0f - 2.0f * mousePos.y / height);
+	glm::vec4 nearPoint = invViewProj * glm::vec4(ndc, -1.0f, 1.0f);
+	glm::vec4 farPoint = invViewProj * glm::vec4(ndc, 1.0f, 1.0f);
 
-	if (hitObject.hitComp && hitChunk && hitObject.hitComp->getParent() == hitChunk->getObject()) {
-		lockParent()->getComponent<RenderComponent>()->setHidden(false);
-
-		glm::vec3 normal = hitObject.hitNormal;
-		//Has all components as 1 except the original normal component
-		glm::vec3 invNormal = glm::abs(glm::abs(normal) - glm::vec3(1, 1, 1));
+	glm::vec3 start = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 end = start + glm::normalize(glm::vec3(farPoint) / farPoint.w - start) * pickRange;
+	BlockHit hit;
 
-		glm::vec3 normalComp = hitObject.hitPos - normal / 2.0f;
-		glm::vec3 otherComp = glm::trunc(hitObject.hitPos) + glm::sign(hitObject.hitPos) / 2.0f;
+	if (chunkLoader->raycast(start, end, hit)) {
+		lockParent()->getComponent<RenderComponent>()->setHidden(false);
 
-		boxPos = normalComp * glm::abs(normal) + otherComp * invNormal;
+		//Center of the block, with z flipped back to world coordinates
+		boxPos = glm::vec3(hit.block.x + 0.5f, hit.block.y + 0.5f, -(hit.block.z + 0.5f));
 	}
 	else {
 		lockParent()->getComponent<RenderComponent>()->setHidden(true);
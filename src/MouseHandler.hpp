@@ -25,6 +25,9 @@
 
 class MouseHandler : public UpdateComponent, ObjectPhysicsInterface {
 public:
+	//How far away blocks can be selected, in blocks.
+	static constexpr float pickRange = 256.0f;
+
 	/**
 	 * Constructor. Does next to nothing.
 	 * @param loader The world's chunk loader.
@@ -33,6 +33,8 @@ const char* const GENERIC_FORMAT = "gncFmt";
 //Buffer elements
 
 const char* const VERTEX_ELEMENT_PACKED_NORM_COLOR = "norCol";
+const char* const VERTEX_ELEMENT_PACKED_POS_NORM = "posNor";
+const char* const VERTEX_ELEMENT_BLOCK_TYPE = "blkTyp";
 
 //Shaders
 
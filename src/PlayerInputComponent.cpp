@@ -89,6 +89,7 @@ bool PlayerInputComponent::onEvent(const std::shared_ptr<const Event> event) {
 
 			switch (keyEvent->key) {
 				case Key::LEFT_ALT: camera->resetFocalPoint(); return true;
+				case Key::F3: lockParent()->getComponent<Mob>(UPDATE_COMPONENT_NAME)->getChunkLoader()->printStats(); return true;
 				default: break;
 			}
 		}
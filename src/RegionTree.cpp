@@ -17,9 +17,244 @@
  ******************************************************************************/
 
 #include <memory>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 
 #include "RegionTree.hpp"
 #include "BlockMap.hpp"
+#include "ByteOrder.hpp"
+
+namespace {
+	//Size of a serialized node, not counting its regions.
+	constexpr size_t nodeDataSize = 12;
+	//Size of a serialized region.
+	constexpr size_t regionDataSize = 8;
+
+	/**
+	 * Checks whether two block ranges share at least one block.
+	 */
+	bool overlaps(const Aabb<uint8_t>& first, const Aabb<uint8_t>& second) {
+		return RegionTreeView::overlaps(first, second);
+	}
+
+	/**
+	 * Grows a block range by one block in every direction, clamped to the chunk.
+	 */
+	Aabb<uint8_t> expand(const Aabb<uint8_t>& box) {
+		Aabb<uint8_t> out = box;
+
+		for (size_t axis = 0; axis < 3; axis++) {
+			if (out.min[axis] > 0) out.min[axis]--;
+			if (out.max[axis] < 255) out.max[axis]++;
+		}
+
+		return out;
+	}
+
+	/**
+	 * Splits a block range into the pieces which lie outside of the cut
+	 * range. At most six pieces are produced, and they never overlap.
+	 * @param box The range to cut.
+	 * @param cut The range to remove, must overlap box.
+	 * @param pieces The vector to store the remaining pieces in.
+	 */
+	void subtractBox(Aabb<uint8_t> box, const Aabb<uint8_t>& cut, std::vector<Aabb<uint8_t>>& pieces) {
+		for (size_t axis = 0; axis < 3; axis++) {
+			if (box.min[axis] < cut.min[axis]) {
+				Aabb<uint8_t> piece = box;
+				piece.max[axis] = cut.min[axis] - 1;
+				pieces.push_back(piece);
+				box.min[axis] = cut.min[axis];
+			}
+
+			if (box.max[axis] > cut.max[axis]) {
+				Aabb<uint8_t> piece = box;
+				piece.min[axis] = cut.max[axis] + 1;
+				pieces.push_back(piece);
+				box.max[axis] = cut.max[axis];
+			}
+		}
+	}
+
+	/**
+	 * Intersects a ray with a block range, treating the range as the volume
+	 * covered by its blocks.
+	 * @param box The range to test.
+	 * @param origin The start of the ray.
+	 * @param dir The direction of the ray.
+	 * @param minDist The start of the tested part of the ray.
+	 * @param maxDist The end of the tested part of the ray.
+	 * @param enterDist Set to where the ray enters the range.
+	 * @param enterAxis Set to the axis whose face the ray enters through, or
+	 *     3 if the ray starts inside the range.
+	 * @return Whether the ray hits the range.
+	 */
+	bool intersectRay(const Aabb<uint8_t>& box, const glm::vec3& origin, const glm::vec3& dir, float minDist, float maxDist, float& enterDist, size_t& enterAxis) {
+		enterDist = minDist;
+		enterAxis = 3;
+
+		for (size_t axis = 0; axis < 3; axis++) {
+			float low = box.min[axis];
+			float high = box.max[axis] + 1.0f;
+
+			//Parallel rays would divide by zero
+			if (dir[axis] == 0.0f) {
+				if (origin[axis] < low || origin[axis] >= high) {
+					return false;
+				}
+
+				continue;
+			}
+
+			float near = (low - origin[axis]) / dir[axis];
+			float far = (high - origin[axis]) / dir[axis];
+
+			if (near > far) {
+				std::swap(near, far);
+			}
+
+			if (near > enterDist) {
+				enterDist = near;
+				enterAxis = axis;
+			}
+
+			maxDist = std::min(maxDist, far);
+
+			if (enterDist > maxDist) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	//A plane to split a node along. The plane lies between block and block + 1.
+	struct SplitPlane {
+		size_t axis;
+		size_t block;
+		//Number of regions crossing the plane.
+		size_t straddling;
+	};
+
+	/**
+	 * Chooses a split through the average center of the regions, on the axis
+	 * where the regions are divided most evenly between the two sides and
+	 * the plane itself.
+	 */
+	SplitPlane averageSplit(const std::vector<InternalRegion>& addRegs) {
+		glm::vec3 avgCenter(0.0f, 0.0f, 0.0f);
+
+		for (const InternalRegion& reg : addRegs) {
+			avgCenter += Aabb<float>(reg.box).getCenter();
+		}
+
+		avgCenter /= addRegs.size();
+		std::array<std::array<size_t, 3>, 3> boxSplitCounts = {};
+
+		//Determine best axis for split (least variation between halves)
+		for (const InternalRegion& reg : addRegs) {
+			for(size_t axis = 0; axis < 3; axis++) {
+				if (reg.box.max[axis] < avgCenter[axis]) {
+					boxSplitCounts[axis][0]++;
+				}
+				else if (reg.box.min[axis] > avgCenter[axis]) {
+					boxSplitCounts[axis][2]++;
+				}
+				else {
+					boxSplitCounts[axis][1]++;
+				}
+			}
+		}
+
+		std::array<size_t, 3> axisScores = {};
+
+		for (size_t i = 0; i < 3; i++) {
+			size_t left = boxSplitCounts[i][0];
+			size_t center = boxSplitCounts[i][1];
+			size_t right = boxSplitCounts[i][2];
+
+			size_t lrDiff = std::max(left, right) - std::min(left, right);
+			size_t lcDiff = std::max(left, center) - std::min(left, center);
+			size_t rcDiff = std::max(right, center) - std::min(right, center);
+
+			axisScores[i] = lrDiff + lcDiff + rcDiff;
+		}
+
+		size_t minAxis = 0;
+
+		for (size_t i = 0; i < 3; i++) {
+			minAxis = axisScores[i] < axisScores[minAxis] ? i : minAxis;
+		}
+
+		return {minAxis, (uint8_t) avgCenter[minAxis], boxSplitCounts[minAxis][1]};
+	}
+
+	/**
+	 * Gets the surface area of a box with the given side lengths.
+	 */
+	double surfaceArea(const std::array<double, 3>& lengths) {
+		return 2.0 * (lengths[0] * lengths[1] + lengths[1] * lengths[2] + lengths[2] * lengths[0]);
+	}
+
+	/**
+	 * Chooses the split with the lowest surface area heuristic cost. Since
+	 * region coordinates are single bytes, every plane through the node is
+	 * its own bin, so the counts on each side are exact. Regions crossing
+	 * the plane stay in the node and are visited by every query reaching it,
+	 * and regions which have to be cut because too many cross the plane are
+	 * charged extra, as they end up as two regions.
+	 * @param box The node being split, must be larger than one block.
+	 * @param addRegs The regions in the node.
+	 */
+	SplitPlane binnedSplit(const Aabb<uint8_t>& box, const std::vector<InternalRegion>& addRegs) {
+		//Extra cost for each region which is cut in two
+		constexpr double cutCost = 2.0;
+
+		std::array<double, 3> lengths = {box.max.x - box.min.x + 1.0, box.max.y - box.min.y + 1.0, box.max.z - box.min.z + 1.0};
+		double nodeArea = surfaceArea(lengths);
+
+		SplitPlane best = {0, box.min.x, addRegs.size()};
+		double bestCost = std::numeric_limits<double>::max();
+
+		for (size_t axis = 0; axis < 3; axis++) {
+			std::array<size_t, 256> minCounts = {};
+			std::array<size_t, 256> maxCounts = {};
+
+			for (const InternalRegion& reg : addRegs) {
+				minCounts[reg.box.min[axis]]++;
+				maxCounts[reg.box.max[axis]]++;
+			}
+
+			//Regions entirely on the lower side and entirely on the upper side
+			size_t below = 0;
+			size_t above = addRegs.size();
+
+			for (size_t block = box.min[axis]; block < box.max[axis]; block++) {
+				below += maxCounts[block];
+				above -= minCounts[block];
+
+				size_t straddling = addRegs.size() - below - above;
+				size_t cut = straddling > RegionTree::splitCount ? straddling - RegionTree::splitCount : 0;
+
+				std::array<double, 3> lowLengths = lengths;
+				std::array<double, 3> highLengths = lengths;
+				lowLengths[axis] = block - box.min[axis] + 1;
+				highLengths[axis] = box.max[axis] - block;
+
+				double cost = (straddling - cut) + cut * cutCost +
+							  (surfaceArea(lowLengths) * (below + cut) + surfaceArea(highLengths) * (above + cut)) / nodeArea;
+
+				if (cost < bestCost) {
+					bestCost = cost;
+					best = {axis, block, straddling};
+				}
+			}
+		}
+
+		return best;
+	}
+}
 
 std::ostream& operator<<(std::ostream& out, const RegionFace& face) {
 	out << "Face[";
@@ -48,65 +283,68 @@ std::ostream& operator<<(std::ostream& out, const RegionFace& face) {
 	return out;
 }
 
-void RegionTree::addRegions(std::vector<InternalRegion> addRegs) {
-	children.clear();
-	regions.clear();
+bool RegionFace::touches(const Aabb<uint8_t>& area) const {
+	uint16_t fixed = getFixedCoord();
 
-	if (addRegs.size() <= splitCount) {
-		regions = addRegs;
-		return;
-	}
+	//Covers the layer of blocks on each side of the face
+	Aabb<uint16_t>::vec_t faceMin;
+	Aabb<uint16_t>::vec_t faceMax;
+	size_t fixedAxis = 0;
+	size_t axis1 = 0;
+	size_t axis2 = 0;
 
-	//Find optimal splits for this node
-	glm::vec3 avgCenter(0.0f, 0.0f, 0.0f);
-
-	for (const InternalRegion& reg : addRegs) {
-		avgCenter += Aabb<float>(reg.box).getCenter();
+	switch (getNormal()) {
+		case 0:
+		case 2: fixedAxis = 2; axis1 = 0; axis2 = 1; break;
+		case 1:
+		case 3: fixedAxis = 0; axis1 = 1; axis2 = 2; break;
+		default: fixedAxis = 1; axis1 = 0; axis2 = 2; break;
 	}
 
-	avgCenter /= addRegs.size();
-	std::array<std::array<size_t, 3>, 3> boxSplitCounts = {};
+	faceMin[fixedAxis] = fixed > 0 ? fixed - 1 : 0;
+	faceMax[fixedAxis] = std::min<uint16_t>(fixed, 255);
+	faceMin[axis1] = min.at(0);
+	faceMax[axis1] = max.at(0) - 1;
+	faceMin[axis2] = min.at(1);
+	faceMax[axis2] = max.at(1) - 1;
 
-	//Determine best axis for split (least variation between halves)
-	for (const InternalRegion& reg : addRegs) {
-		for(size_t axis = 0; axis < 3; axis++) {
-			if (reg.box.max[axis] < avgCenter[axis]) {
-				boxSplitCounts[axis][0]++;
-			}
-			else if (reg.box.min[axis] > avgCenter[axis]) {
-				boxSplitCounts[axis][2]++;
-			}
-			else {
-				boxSplitCounts[axis][1]++;
-			}
+	for (size_t axis = 0; axis < 3; axis++) {
+		if (faceMin[axis] > area.max[axis] || faceMax[axis] < area.min[axis]) {
+			return false;
 		}
 	}
 
-	std::array<size_t, 3> axisScores = {};
-
-	for (size_t i = 0; i < 3; i++) {
-		size_t left = boxSplitCounts[i][0];
-		size_t center = boxSplitCounts[i][1];
-		size_t right = boxSplitCounts[i][2];
+	return true;
+}
 
-		size_t lrDiff = std::max(left, right) - std::min(left, right);
-		size_t lcDiff = std::max(left, center) - std::min(left, center);
-		size_t rcDiff = std::max(right, center) - std::min(right, center);
+void RegionTree::addRegions(std::vector<InternalRegion> addRegs, SplitMode mode) {
+	splitMode = mode;
+	nodes.resize(1);
+	nodes.front() = {nodes.front().box, 0, 0, 0, 0, 0};
+	regions.clear();
+	regions.reserve(addRegs.size());
 
-		axisScores[i] = lrDiff + lcDiff + rcDiff;
-	}
+	buildNode(0, std::move(addRegs));
 
-	size_t minAxis = 0;
+	//Splitting adds a few regions, so the reserved space usually isn't enough
+	nodes.shrink_to_fit();
+	regions.shrink_to_fit();
+}
 
-	for (size_t i = 0; i < 3; i++) {
-		minAxis = axisScores[i] < axisScores[minAxis] ? i : minAxis;
+void RegionTree::buildNode(size_t node, std::vector<InternalRegion> addRegs) {
+	if (addRegs.size() <= splitCount) {
+		setNodeRegions(node, addRegs);
+		updateCount(node);
+		return;
 	}
 
-	size_t splitBlock = (uint8_t) avgCenter[minAxis];
+	SplitPlane plane = splitMode == SplitMode::BINNED_SAH ? binnedSplit(nodes.at(node).box, addRegs) : averageSplit(addRegs);
+	size_t minAxis = plane.axis;
+	size_t splitBlock = plane.block;
 
 	//Force extra regions to move to children
-	if (boxSplitCounts[minAxis][1] > splitCount) {
-		size_t toRemove = boxSplitCounts[minAxis][1] - splitCount;
+	if (plane.straddling > splitCount) {
+		size_t toRemove = plane.straddling - splitCount;
 
 		for (size_t i = 0; i < addRegs.size(); i++) {
 			InternalRegion& reg = addRegs.at(i);
@@ -129,15 +367,23 @@ void RegionTree::addRegions(std::vector<InternalRegion> addRegs) {
 		}
 	}
 
-	//Create children
-	std::array<Aabb<uint8_t>, 2> childBoxes = box.bisect(minAxis, splitBlock);
+	//Create children, next to each other at the end of the node array
+	std::array<Aabb<uint8_t>, 2> childBoxes = nodes.at(node).box.bisect(minAxis, splitBlock);
+	size_t firstChild = nodes.size();
+
+	nodes.at(node).firstChild = firstChild;
+	nodes.at(node).childCount = childBoxes.size();
 
 	for (Aabb<uint8_t> childBox : childBoxes) {
 		//Internal regions are stored as blocks, not bounding boxes, so
 		//we have to make sure two children can't contain the same region
 		if (childBox.min[minAxis] == splitBlock) childBox.min[minAxis]++;
 
-		children.emplace_back(childBox);
+		nodes.push_back({childBox, 0, 0, 0, 0, 0});
+	}
+
+	for (size_t child = firstChild; child < firstChild + childBoxes.size(); child++) {
+		Aabb<uint8_t> childBox = nodes.at(child).box;
 
 		//Add regions to child
 		std::vector<InternalRegion> childAdd;
@@ -152,94 +398,306 @@ void RegionTree::addRegions(std::vector<InternalRegion> addRegs) {
 			}
 		}
 
-		children.back().addRegions(childAdd);
+		buildNode(child, childAdd);
 	}
 
 	//Everything else goes in this node
-	regions = addRegs;
+	setNodeRegions(node, addRegs);
+	updateCount(node);
 }
 
-size_t RegionTree::size() const {
-	size_t count = regions.size();
 
-	for (const RegionTree& child : children) {
-		count += child.size();
+void RegionTree::insertRegion(const InternalRegion& reg, Aabb<uint8_t>& changed) {
+	//Nodes whose counts change
+	std::vector<size_t> path = {0};
+	bool descended = true;
+
+	while (descended) {
+		const RegionNode& node = nodes.at(path.back());
+		descended = false;
+
+		for (size_t child = node.firstChild; child < node.firstChild + node.childCount; child++) {
+			if (nodes.at(child).box.contains(reg.box)) {
+				path.push_back(child);
+				descended = true;
+				break;
+			}
+		}
+	}
+
+	size_t node = path.back();
+	const RegionNode& target = nodes.at(node);
+	std::vector<InternalRegion> nodeRegs(regions.begin() + target.regionStart, regions.begin() + target.regionStart + target.regionCount);
+	nodeRegs.push_back(reg);
+
+	//Only leaves get split again, as rebuilding an internal node
+	//would discard its children. Splitting can cut any region in the leaf.
+	if (target.childCount == 0 && nodeRegs.size() > 2 * splitCount) {
+		setNodeRegions(node, {});
+		buildNode(node, nodeRegs);
+		changed = Aabb<uint8_t>(changed, nodes.at(node).box);
+	}
+	else {
+		setNodeRegions(node, nodeRegs);
 	}
 
-	return count;
+	for (size_t i = path.size(); i > 0; i--) {
+		updateCount(path.at(i - 1));
+	}
 }
 
-std::vector<RegionFace> RegionTree::genQuads() const {
-	std::unique_ptr<BlockMap> map = std::make_unique<BlockMap>();
+void RegionTree::insertUncovered(const InternalRegion& reg, Aabb<uint8_t>& changed) {
+	std::vector<InternalRegion> covered;
+	getView().collectOverlapping(reg.box, covered);
 
-	fillMap(*map);
+	std::vector<Aabb<uint8_t>> pieces = {reg.box};
 
-	std::vector<RegionFace> faces;
-	generateFaces(*map, faces);
+	for (const InternalRegion& cut : covered) {
+		std::vector<Aabb<uint8_t>> remaining;
 
-	return faces;
-}
+		for (const Aabb<uint8_t>& piece : pieces) {
+			if (overlaps(piece, cut.box)) {
+				subtractBox(piece, cut.box, remaining);
+			}
+			else {
+				remaining.push_back(piece);
+			}
+		}
+
+		pieces.swap(remaining);
+	}
 
-void RegionTree::printCounts(std::string idents) const {
-	std::cout << idents << regions.size() << "\n";
-	for (const RegionTree& child : children) {
-		child.printCounts(idents + "  ");
+	for (const Aabb<uint8_t>& piece : pieces) {
+		insertRegion({reg.type, piece}, changed);
 	}
 }
 
-size_t RegionTree::getNodeCount() const {
-	size_t count = 1;
+bool RegionTree::removeBox(const Aabb<uint8_t>& remBox, Aabb<uint8_t>& changed) {
+	return removeBox(0, remBox, changed);
+}
+
+bool RegionTree::removeBox(size_t node, const Aabb<uint8_t>& remBox, Aabb<uint8_t>& changed) {
+	if (!overlaps(nodes.at(node).box, remBox)) {
+		return false;
+	}
+
+	const RegionNode& target = nodes.at(node);
+	std::vector<InternalRegion> nodeRegs(regions.begin() + target.regionStart, regions.begin() + target.regionStart + target.regionCount);
+	std::vector<Aabb<uint8_t>> pieces;
+	bool removed = false;
+
+	for (size_t i = 0; i < nodeRegs.size(); i++) {
+		InternalRegion reg = nodeRegs.at(i);
+
+		if (!overlaps(reg.box, remBox)) {
+			continue;
+		}
+
+		pieces.clear();
+		subtractBox(reg.box, remBox, pieces);
+		changed = Aabb<uint8_t>(changed, reg.box);
+
+		nodeRegs.at(i) = nodeRegs.back();
+		nodeRegs.pop_back();
+		i--;
+
+		//Pieces are appended after the current index, and
+		//can't overlap the removed box, so they get skipped
+		for (const Aabb<uint8_t>& piece : pieces) {
+			nodeRegs.push_back({reg.type, piece});
+		}
+
+		removed = true;
+	}
+
+	if (removed) {
+		setNodeRegions(node, nodeRegs);
+	}
 
-	for (const RegionTree& child : children) {
-		count += child.getNodeCount();
+	for (size_t child = target.firstChild; child < target.firstChild + target.childCount; child++) {
+		removed = removeBox(child, remBox, changed) || removed;
 	}
 
-	return count;
+	updateCount(node);
+	return removed;
 }
 
-size_t RegionTree::getMemUsage() const {
-	size_t mem = sizeof(RegionTree);
+Aabb<uint8_t> RegionTree::mergeAround(const Aabb<uint8_t>& area) {
+	Aabb<uint8_t> changed = area;
+	mergeAround(0, expand(area), changed);
+
+	return changed;
+}
+
+void RegionTree::mergeAround(size_t node, const Aabb<uint8_t>& touchBox, Aabb<uint8_t>& changed) {
+	if (!overlaps(nodes.at(node).box, touchBox)) {
+		return;
+	}
+
+	const RegionNode& target = nodes.at(node);
+	std::vector<InternalRegion> nodeRegs(regions.begin() + target.regionStart, regions.begin() + target.regionStart + target.regionCount);
+	bool merged = false;
+
+	for (size_t i = 0; i < nodeRegs.size(); i++) {
+		if (!overlaps(nodeRegs.at(i).box, touchBox)) {
+			continue;
+		}
+
+		for (size_t j = 0; j < nodeRegs.size(); j++) {
+			InternalRegion& reg = nodeRegs.at(i);
+			const InternalRegion& testReg = nodeRegs.at(j);
 
-	mem += regions.capacity() * sizeof(InternalRegion);
+			if (i == j || testReg.type != reg.type) {
+				continue;
+			}
+
+			Aabb<uint64_t> box1(testReg.box);
+			Aabb<uint64_t> box2(reg.box);
+
+			box1.max += 1;
+			box2.max += 1;
+
+			if (box1.formsBoxWith(box2)) {
+				reg.box = Aabb<uint8_t>(testReg.box, reg.box);
+				changed = Aabb<uint8_t>(changed, reg.box);
+				nodeRegs.at(j) = nodeRegs.back();
+				nodeRegs.pop_back();
+				merged = true;
+
+				//The merged region may have been moved by the removal
+				if (i == nodeRegs.size()) {
+					i = j;
+				}
+
+				j = -1;
+			}
+		}
+	}
 
-	for (const RegionTree& child : children) {
-		mem += child.getMemUsage() - sizeof(RegionTree);
+	if (merged) {
+		setNodeRegions(node, nodeRegs);
 	}
 
-	mem += children.capacity() * sizeof(RegionTree);
+	for (size_t child = target.firstChild; child < target.firstChild + target.childCount; child++) {
+		mergeAround(child, touchBox, changed);
+	}
 
-	return mem;
+	updateCount(node);
 }
 
-void RegionTree::fillMap(BlockMap& map) const {
-	for (const InternalRegion& reg : regions) {
-		map.addRegionFill(reg);
+size_t RegionTree::deserialize(const unsigned char* data, size_t length) {
+	nodes.assign(1, {nodes.front().box, 0, 0, 0, 0, 0});
+	regions.clear();
+
+	return deserializeNode(0, data, length);
+}
+
+size_t RegionTree::deserializeNode(size_t node, const unsigned char* data, size_t length) {
+	if (length < nodeDataSize) {
+		throw std::runtime_error("Truncated region tree data!");
 	}
 
-	for (const RegionTree& child : children) {
-		child.fillMap(map);
+	RegionNode& target = nodes.at(node);
+
+	for (size_t axis = 0; axis < 3; axis++) {
+		target.box.min[axis] = data[axis];
+		target.box.max[axis] = data[3 + axis];
 	}
+
+	size_t childCount = data[6];
+	size_t regionCount = getU32(data + 8);
+	size_t used = nodeDataSize + regionCount * regionDataSize;
+
+	if (length < used) {
+		throw std::runtime_error("Truncated region tree data!");
+	}
+
+	target.regionStart = regions.size();
+	target.regionCount = regionCount;
+	target.childCount = childCount;
+	target.firstChild = nodes.size();
+	regions.resize(regions.size() + regionCount);
+
+	for (size_t i = 0; i < regionCount; i++) {
+		const unsigned char* regData = data + nodeDataSize + i * regionDataSize;
+		InternalRegion& reg = regions.at(target.regionStart + i);
+
+		reg.type = getU16(regData);
+
+		for (size_t axis = 0; axis < 3; axis++) {
+			reg.box.min[axis] = regData[2 + axis];
+			reg.box.max[axis] = regData[5 + axis];
+		}
+	}
+
+	//Invalidates target
+	size_t firstChild = target.firstChild;
+	nodes.resize(nodes.size() + childCount);
+
+	for (size_t child = firstChild; child < firstChild + childCount; child++) {
+		used += deserializeNode(child, data + used, length - used);
+	}
+
+	updateCount(node);
+	return used;
 }
 
-void RegionTree::generateFaces(const BlockMap& map, std::vector<RegionFace>& faces) const {
-	//Collect all region faces, discard those which are covered
-	for (const InternalRegion& region : regions) {
-		std::array<RegionFace, 6> genFaces = genRegionFaces(region);
+void RegionTree::assign(const RegionTreeView& view) {
+	if (view.getNodeCount() == 0) {
+		nodes.assign(1, {Aabb<uint8_t>({0, 0, 0}, {255, 255, 255}), 0, 0, 0, 0, 0});
+		regions.clear();
+		return;
+	}
 
-		for (const RegionFace& face : genFaces) {
-			if (map.isFaceVisible(face)) {
-				faces.push_back(face);
+	nodes.assign(view.getNodes(), view.getNodes() + view.getNodeCount());
+	regions.assign(view.getRegions(), view.getRegions() + view.size());
+}
+
+void RegionTree::setNodeRegions(size_t node, const std::vector<InternalRegion>& newRegs) {
+	RegionNode& target = nodes.at(node);
+
+	//An empty range can lie inside another node's range, so start a new one at the end
+	if (target.regionCount == 0) {
+		target.regionStart = regions.size();
+	}
+
+	size_t rangeEnd = target.regionStart + target.regionCount;
+	int64_t diff = (int64_t) newRegs.size() - (int64_t) target.regionCount;
+
+	if (diff > 0) {
+		//Edits only add a few regions at a time, so grow by less than the default doubling
+		if (regions.size() + diff > regions.capacity()) {
+			regions.reserve(regions.size() + diff + regions.size() / 8);
+		}
+
+		regions.insert(regions.begin() + rangeEnd, diff, InternalRegion{});
+	}
+	else if (diff < 0) {
+		regions.erase(regions.begin() + rangeEnd + diff, regions.begin() + rangeEnd);
+	}
+
+	std::copy(newRegs.begin(), newRegs.end(), regions.begin() + target.regionStart);
+	target.regionCount = newRegs.size();
+
+	if (diff != 0) {
+		for (size_t i = 0; i < nodes.size(); i++) {
+			if (i != node && nodes.at(i).regionStart >= rangeEnd) {
+				nodes.at(i).regionStart += diff;
 			}
 		}
 	}
+}
 
-	//Recurse to children
-	for (const RegionTree& child : children) {
-		child.generateFaces(map, faces);
+void RegionTree::updateCount(size_t node) {
+	RegionNode& target = nodes.at(node);
+	target.subtreeRegions = target.regionCount;
+
+	for (size_t child = target.firstChild; child < target.firstChild + target.childCount; child++) {
+		target.subtreeRegions += nodes.at(child).subtreeRegions;
 	}
 }
 
-std::array<RegionFace, 6> RegionTree::genRegionFaces(const InternalRegion& region) const {
+std::array<RegionFace, 6> RegionTree::genRegionFaces(const InternalRegion& region) {
 	//Don't bother to use the expanded box here, it would only require more casting
 	Aabb<uint16_t>::vec_t min = region.box.min;
 	Aabb<uint16_t>::vec_t max(region.box.max.x + 1, region.box.max.y + 1, region.box.max.z + 1);
@@ -259,3 +717,264 @@ std::array<RegionFace, 6> RegionTree::genRegionFaces(const InternalRegion& regio
 		RegionFace{(uint16_t) (0xA00 | min.y), {min.x, min.z}, {max.x, max.z}, region.type}
 	};
 }
+
+bool RegionTreeView::validate() const {
+	if (nodeCount == 0) {
+		return regionCount == 0;
+	}
+
+	for (size_t i = 0; i < nodeCount; i++) {
+		const RegionNode& node = nodes[i];
+
+		if (node.childCount > 0 && (node.firstChild <= i || (uint64_t) node.firstChild + node.childCount > nodeCount)) {
+			return false;
+		}
+
+		if ((uint64_t) node.regionStart + node.regionCount > regionCount) {
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < regionCount; i++) {
+		const Aabb<uint8_t>& box = regions[i].box;
+
+		if (box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z) {
+			return false;
+		}
+	}
+
+	return nodes[0].subtreeRegions == regionCount;
+}
+
+std::vector<RegionFace> RegionTreeView::genQuads(FaceMode mode, const NeighborPlanes& neighbors) const {
+	//All regions are in one array, so there's no need to walk the nodes
+	BlockMapPool::Handle map = BlockMapPool::acquire();
+
+	for (size_t normal = 0; normal < neighbors.size(); normal++) {
+		map->setNeighbor(normal, neighbors.at(normal));
+	}
+
+	for (size_t i = 0; i < regionCount; i++) {
+		map->addRegionFill(regions[i]);
+	}
+
+	std::vector<RegionFace> faces;
+
+	for (size_t i = 0; i < regionCount; i++) {
+		for (const RegionFace& face : RegionTree::genRegionFaces(regions[i])) {
+			if (mode == FaceMode::SPLIT) {
+				map->addVisibleParts(face, faces);
+			}
+			else if (map->isFaceVisible(face)) {
+				faces.push_back(face);
+			}
+		}
+	}
+
+	return faces;
+}
+
+std::vector<RegionFace> RegionTreeView::genQuads(const Aabb<uint8_t>& area, FaceMode mode, std::vector<RegionFace>* sourceFaces,
+	const NeighborPlanes& neighbors) const {
+
+	//Only regions next to the area can have faces touching it
+	std::vector<RegionFace> faces;
+	std::vector<InternalRegion> nearRegions;
+	collectOverlapping(expand(area), nearRegions);
+
+	if (nearRegions.empty()) {
+		return faces;
+	}
+
+	//Visibility of those faces only depends on the blocks directly around
+	//the regions, so the map doesn't need the rest of the chunk
+	Aabb<uint8_t> mapArea = expand(nearRegions.front().box);
+
+	for (const InternalRegion& reg : nearRegions) {
+		mapArea = Aabb<uint8_t>(mapArea, expand(reg.box));
+	}
+
+	std::vector<InternalRegion> mapRegions;
+	collectOverlapping(mapArea, mapRegions);
+
+	BlockMapPool::Handle map = BlockMapPool::acquire();
+
+	for (size_t normal = 0; normal < neighbors.size(); normal++) {
+		map->setNeighbor(normal, neighbors.at(normal));
+	}
+
+	for (const InternalRegion& reg : mapRegions) {
+		map->addRegionFill(reg);
+	}
+
+	for (const InternalRegion& reg : nearRegions) {
+		for (const RegionFace& face : RegionTree::genRegionFaces(reg)) {
+			if (!face.touches(area)) {
+				continue;
+			}
+
+			if (sourceFaces) {
+				sourceFaces->push_back(face);
+			}
+
+			if (mode == FaceMode::SPLIT) {
+				map->addVisibleParts(face, faces);
+			}
+			else if (map->isFaceVisible(face)) {
+				faces.push_back(face);
+			}
+		}
+	}
+
+	return faces;
+}
+
+const InternalRegion* RegionTreeView::query(const Aabb<uint8_t>::vec_t& point) const {
+	Aabb<uint8_t> pointBox(point, point);
+	size_t current = 0;
+	bool descended = nodeCount > 0 && overlaps(nodes[0].box, pointBox);
+
+	//Children never overlap, so at most one needs to be searched
+	while (descended) {
+		const RegionNode& node = nodes[current];
+		descended = false;
+
+		for (size_t i = node.regionStart; i < node.regionStart + node.regionCount; i++) {
+			if (overlaps(regions[i].box, pointBox)) {
+				return &regions[i];
+			}
+		}
+
+		for (size_t child = node.firstChild; child < node.firstChild + node.childCount; child++) {
+			if (overlaps(nodes[child].box, pointBox)) {
+				current = child;
+				descended = true;
+				break;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+bool RegionTreeView::raycast(const glm::vec3& origin, const glm::vec3& dir, float minDist, float maxDist, RegionHit& hit) const {
+	//Faces entered when moving in the positive and negative direction along each axis
+	constexpr std::array<uint8_t, 3> positiveFaces = {3, 5, 0};
+	constexpr std::array<uint8_t, 3> negativeFaces = {1, 4, 2};
+
+	if (nodeCount == 0) {
+		return false;
+	}
+
+	bool found = false;
+	float closest = maxDist;
+	size_t closestAxis = 3;
+	std::vector<size_t> toVisit = {0};
+
+	while (!toVisit.empty()) {
+		const RegionNode& node = nodes[toVisit.back()];
+		toVisit.pop_back();
+
+		float enterDist;
+		size_t enterAxis;
+
+		if (!intersectRay(node.box, origin, dir, minDist, closest, enterDist, enterAxis)) {
+			continue;
+		}
+
+		for (size_t i = node.regionStart; i < node.regionStart + node.regionCount; i++) {
+			if (intersectRay(regions[i].box, origin, dir, minDist, closest, enterDist, enterAxis) && (!found || enterDist < closest)) {
+				found = true;
+				closest = enterDist;
+				closestAxis = enterAxis;
+				hit.region = regions[i];
+			}
+		}
+
+		for (size_t child = node.firstChild; child < node.firstChild + node.childCount; child++) {
+			toVisit.push_back(child);
+		}
+	}
+
+	if (!found) {
+		return false;
+	}
+
+	//The block is on the entered face of the region, at the point the ray hit it
+	glm::vec3 point = origin + dir * closest;
+	const Aabb<uint8_t>& box = hit.region.box;
+
+	for (size_t axis = 0; axis < 3; axis++) {
+		if (axis == closestAxis) {
+			hit.block[axis] = dir[axis] > 0.0f ? box.min[axis] : box.max[axis];
+		}
+		else {
+			float block = std::floor(point[axis]);
+			hit.block[axis] = std::max<float>(box.min[axis], std::min<float>(box.max[axis], block));
+		}
+	}
+
+	if (closestAxis == 3) {
+		hit.face = 6;
+	}
+	else {
+		hit.face = dir[closestAxis] > 0.0f ? positiveFaces[closestAxis] : negativeFaces[closestAxis];
+	}
+
+	hit.distance = closest;
+	return true;
+}
+
+void RegionTreeView::collectOverlapping(const Aabb<uint8_t>& area, std::vector<InternalRegion>& out) const {
+	forEachOverlapping(area, [&](const InternalRegion& reg) {
+		out.push_back(reg);
+	});
+}
+
+void RegionTreeView::serialize(std::vector<unsigned char>& out) const {
+	if (nodeCount > 0) {
+		serializeNode(0, out);
+	}
+}
+
+void RegionTreeView::serializeNode(size_t node, std::vector<unsigned char>& out) const {
+	const RegionNode& target = nodes[node];
+	size_t start = out.size();
+	out.resize(start + nodeDataSize + target.regionCount * regionDataSize);
+
+	unsigned char* data = &out.at(start);
+
+	for (size_t axis = 0; axis < 3; axis++) {
+		data[axis] = target.box.min[axis];
+		data[3 + axis] = target.box.max[axis];
+	}
+
+	data[6] = target.childCount;
+	data[7] = 0;
+	putU32(data + 8, target.regionCount);
+
+	for (size_t i = 0; i < target.regionCount; i++) {
+		const InternalRegion& reg = regions[target.regionStart + i];
+		unsigned char* regData = data + nodeDataSize + i * regionDataSize;
+
+		putU16(regData, reg.type);
+
+		for (size_t axis = 0; axis < 3; axis++) {
+			regData[2 + axis] = reg.box.min[axis];
+			regData[5 + axis] = reg.box.max[axis];
+		}
+	}
+
+	for (size_t child = target.firstChild; child < target.firstChild + target.childCount; child++) {
+		serializeNode(child, out);
+	}
+}
+
+void RegionTreeView::printCounts(size_t node, std::string idents) const {
+	const RegionNode& target = nodes[node];
+	std::cout << idents << target.regionCount << "\n";
+
+	for (size_t child = target.firstChild; child < target.firstChild + target.childCount; child++) {
+		printCounts(child, idents + "  ");
+	}
+}
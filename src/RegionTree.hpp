@@ -24,6 +24,11 @@
 #include "AxisAlignedBB.hpp"
 
 class BlockMap;
+class BoundaryPlane;
+
+//Planes of blocks next to a chunk, indexed by the normal of faces pointing
+//at them. Null planes are treated as empty.
+typedef std::array<const BoundaryPlane*, 6> NeighborPlanes;
 
 struct InternalRegion {
 	uint16_t type;
@@ -43,95 +48,475 @@ struct RegionFace {
 
 	uint16_t getNormal() const { return normFixed >> 9; }
 	uint16_t getFixedCoord() const { return normFixed & 0x1FF; }
+
+	/**
+	 * Checks whether the blocks on either side of this face overlap the
+	 * given block range. If they don't, changes to blocks in the range can
+	 * not affect the face.
+	 * @param area The block range to check.
+	 * @return Whether the face touches the range.
+	 */
+	bool touches(const Aabb<uint8_t>& area) const;
 };
 
 std::ostream& operator<<(std::ostream& out, const RegionFace& face);
 
+//A node of a region tree flattened into arrays. Children of a node are
+//stored next to each other, and a node's regions are a range in a separate
+//region array.
+struct RegionNode {
+	//Block range covered by the node.
+	Aabb<uint8_t> box;
+	//Number of children, starting at firstChild.
+	uint16_t childCount;
+	//Index of the node's first child in the node array.
+	uint32_t firstChild;
+	//Start of the node's regions in the region array.
+	uint32_t regionStart;
+	//Number of regions stored directly in the node.
+	uint32_t regionCount;
+	//Number of regions in the node and all of its descendants.
+	uint32_t subtreeRegions;
+};
+
+//Result of casting a ray through a region tree.
+struct RegionHit {
+	//The region which was hit.
+	InternalRegion region;
+	//The block in the region where the ray entered it.
+	Aabb<uint8_t>::vec_t block;
+	//Face the ray entered through, numbered as the normals in RegionFace.
+	//6 if the ray started inside the region.
+	uint8_t face;
+	//Distance along the ray, in multiples of its direction vector.
+	float distance;
+};
+
+/**
+ * A read-only region tree which uses flattened node and region arrays
+ * owned by something else, such as a RegionTree or a memory mapped file.
+ * Nothing is copied when creating a view.
+ */
+class RegionTreeView {
+public:
+	//Ways of generating faces for the regions.
+	enum class FaceMode {
+		//Emit a region's whole face if any part of it is visible.
+		WHOLE,
+		//Emit only the visible parts of each face, merged into rectangles.
+		//Gives smaller meshes with less overdraw, but takes longer.
+		SPLIT
+	};
+
+	constexpr static FaceMode defaultFaceMode = FaceMode::SPLIT;
+
+	/**
+	 * Creates an empty view.
+	 */
+	RegionTreeView() : nodes(nullptr), nodeCount(0), regions(nullptr), regionCount(0) {}
+
+	/**
+	 * Creates a view of the given arrays, which must outlive the view.
+	 * @param nodes The flattened nodes, starting with the root.
+	 * @param nodeCount The number of nodes.
+	 * @param regions The regions referenced by the nodes.
+	 * @param regionCount The number of regions.
+	 */
+	RegionTreeView(const RegionNode* nodes, size_t nodeCount, const InternalRegion* regions, size_t regionCount) :
+		nodes(nodes),
+		nodeCount(nodeCount),
+		regions(regions),
+		regionCount(regionCount) {}
+
+	/**
+	 * Checks that every child and region range in the nodes is in bounds,
+	 * and that children always come after their parents.
+	 * @return Whether the view can be traversed safely.
+	 */
+	bool validate() const;
+
+	/**
+	 * Gets the number of regions stored in the tree.
+	 * @return The number of regions.
+	 */
+	size_t size() const { return regionCount; }
+
+	/**
+	 * Gets the number of nodes in the tree.
+	 * @return The number of nodes.
+	 */
+	size_t getNodeCount() const { return nodeCount; }
+
+	/**
+	 * Generates faces from the stored regions so the chunk can be rendered.
+	 * @param mode How to handle partially covered faces.
+	 * @param neighbors Used to cull faces on the edges of the tree.
+	 * @return A list of faces making up the mesh.
+	 */
+	std::vector<RegionFace> genQuads(FaceMode mode = defaultFaceMode, const NeighborPlanes& neighbors = NeighborPlanes()) const;
+
+	/**
+	 * Generates only the visible faces which touch the given area, as
+	 * determined by RegionFace::touches. Only the regions near the area are
+	 * used for coverage lookups. When splitting faces, the visible parts of
+	 * a touching face are all generated, even if some don't touch the area.
+	 * @param area The block range to generate faces for.
+	 * @param mode How to handle partially covered faces.
+	 * @param sourceFaces If not null, set to the whole faces touching the
+	 *     area, before they were split.
+	 * @param neighbors Used to cull faces on the edges of the tree.
+	 * @return The faces touching the area.
+	 */
+	std::vector<RegionFace> genQuads(const Aabb<uint8_t>& area, FaceMode mode = defaultFaceMode, std::vector<RegionFace>* sourceFaces = nullptr,
+		const NeighborPlanes& neighbors = NeighborPlanes()) const;
+
+	/**
+	 * Finds the region containing the given block. Only the nodes
+	 * containing the block are searched.
+	 * @param point The block to look up.
+	 * @return The region containing the block, or nullptr if it is empty.
+	 */
+	const InternalRegion* query(const Aabb<uint8_t>::vec_t& point) const;
+
+	/**
+	 * Calls a function for every region overlapping the given box, skipping
+	 * nodes which don't overlap it.
+	 * @param area The block range to check.
+	 * @param fn The function to call, taking a const InternalRegion&.
+	 */
+	template<typename Func>
+	void forEachOverlapping(const Aabb<uint8_t>& area, Func fn) const {
+		if (nodeCount == 0) {
+			return;
+		}
+
+		std::vector<size_t> toVisit = {0};
+
+		while (!toVisit.empty()) {
+			const RegionNode& node = nodes[toVisit.back()];
+			toVisit.pop_back();
+
+			if (!overlaps(node.box, area)) {
+				continue;
+			}
+
+			for (size_t i = node.regionStart; i < node.regionStart + node.regionCount; i++) {
+				if (overlaps(regions[i].box, area)) {
+					fn(regions[i]);
+				}
+			}
+
+			for (size_t child = node.firstChild; child < node.firstChild + node.childCount; child++) {
+				toVisit.push_back(child);
+			}
+		}
+	}
+
+	/**
+	 * Collects all regions which overlap the given box.
+	 * @param area The block range to check.
+	 * @param out The vector to store the overlapping regions in.
+	 */
+	void collectOverlapping(const Aabb<uint8_t>& area, std::vector<InternalRegion>& out) const;
+
+	/**
+	 * Finds the first region hit by a ray. Each node and region is tested as
+	 * a whole, so empty space and large regions cost no more than small ones,
+	 * and nodes farther away than the closest hit so far are skipped.
+	 * @param origin The start of the ray, in blocks relative to the tree's corner.
+	 * @param dir The direction of the ray, doesn't need to be normalized.
+	 * @param minDist Where to start along the ray, in multiples of dir.
+	 * @param maxDist Where to stop along the ray, in multiples of dir.
+	 * @param hit Set to the closest hit, if there is one.
+	 * @return Whether a region was hit.
+	 */
+	bool raycast(const glm::vec3& origin, const glm::vec3& dir, float minDist, float maxDist, RegionHit& hit) const;
+
+	/**
+	 * Checks whether two block ranges share at least one block.
+	 * @param first The first range.
+	 * @param second The second range.
+	 * @return Whether the ranges overlap.
+	 */
+	static bool overlaps(const Aabb<uint8_t>& first, const Aabb<uint8_t>& second) {
+		return first.min.x <= second.max.x && first.max.x >= second.min.x &&
+			   first.min.y <= second.max.y && first.max.y >= second.min.y &&
+			   first.min.z <= second.max.z && first.max.z >= second.min.z;
+	}
+
+	/**
+	 * Appends the tree to the given buffer. Nodes are written depth first,
+	 * each as its block range, child count, and region count, followed by
+	 * its regions and then its children.
+	 * @param out The buffer to write to.
+	 */
+	void serialize(std::vector<unsigned char>& out) const;
+
+	/**
+	 * Prints the number of regions for each node in a nicely formatted manner.
+	 * @param node The node to start at.
+	 * @param The number of indentations to put before the count.
+	 */
+	void printCounts(size_t node = 0, std::string idents = "") const;
+
+	/**
+	 * Gets the flattened nodes.
+	 * @return The node array.
+	 */
+	const RegionNode* getNodes() const { return nodes; }
+
+	/**
+	 * Gets the flattened regions.
+	 * @return The region array.
+	 */
+	const InternalRegion* getRegions() const { return regions; }
+
+private:
+	//The flattened nodes, root first.
+	const RegionNode* nodes;
+	//Number of nodes.
+	size_t nodeCount;
+	//All regions in the tree.
+	const InternalRegion* regions;
+	//Number of regions.
+	size_t regionCount;
+
+	/**
+	 * Writes a single node and its descendants for serialize.
+	 */
+	void serializeNode(size_t node, std::vector<unsigned char>& out) const;
+};
+
+/**
+ * A tree of regions stored as two flat arrays - one holding every node, with
+ * the children of a node next to each other, and one holding every region,
+ * with each node's regions forming a contiguous range. Traversals never
+ * leave these two arrays, and all read-only operations are done through a
+ * RegionTreeView of them.
+ */
 class RegionTree {
 public:
 	constexpr static size_t splitCount = 1024;
 
+	//Ways of choosing where to split a node with too many regions.
+	enum class SplitMode {
+		//Split through the average region center, on the axis which
+		//divides the regions most evenly.
+		AVERAGE,
+		//Try every plane through the node, and pick the one with the lowest
+		//surface area cost. Planes which would cut regions cost more.
+		BINNED_SAH
+	};
+
+	constexpr static SplitMode defaultSplitMode = SplitMode::BINNED_SAH;
+
 	/**
 	 * Constructs an empry tree with the given bounding box.
 	 * @param box The box for the node.
 	 */
-	RegionTree(Aabb<uint8_t> box = Aabb<uint8_t>({0, 0, 0}, {255, 255, 255})) : box(box) {}
+	RegionTree(Aabb<uint8_t> box = Aabb<uint8_t>({0, 0, 0}, {255, 255, 255})) :
+		nodes{{box, 0, 0, 0, 0, 0}},
+		splitMode(defaultSplitMode) {}
 
 	/**
 	 * Adds a list of regions to the tree. This does not do any checking for
 	 * if the regions are intersecting or such, and is primarily intended to
-	 * be called when generating a chunk or loading from disk. When this is
-	 * called, it is assumed the the node's internal region and child
-	 * lists are empty - if they are not, all existing regions and children
-	 * are discarded.
+	 * be called when generating a chunk or loading from disk. All existing
+	 * regions and children are discarded.
 	 * @param addRegs The regions to add.
+	 * @param mode How to split nodes, also used when leaves are split by later inserts.
+	 */
+	void addRegions(std::vector<InternalRegion> addRegs, SplitMode mode = defaultSplitMode);
+
+	/**
+	 * Inserts a single region into the deepest node that fully contains it.
+	 * As with addRegions, the region is assumed to not overlap any regions
+	 * already in the tree. Leaves which grow too large are split again.
+	 * @param reg The region to insert.
+	 * @param changed Grown to contain any regions changed by splitting a leaf.
+	 */
+	void insertRegion(const InternalRegion& reg, Aabb<uint8_t>& changed);
+
+	/**
+	 * Inserts the parts of the given region which are not already covered
+	 * by a region in the tree, leaving existing regions untouched.
+	 * @param reg The region to insert.
+	 * @param changed Grown to contain any regions changed by splitting a leaf.
+	 */
+	void insertUncovered(const InternalRegion& reg, Aabb<uint8_t>& changed);
+
+	/**
+	 * Removes the given block range from all regions in the tree. Regions
+	 * which only partially overlap the box are split into the pieces outside
+	 * of it, which stay in the same node as the original region.
+	 * @param remBox The block range to clear.
+	 * @param changed Grown to contain the original box of every changed region.
+	 * @return Whether any region was changed.
+	 */
+	bool removeBox(const Aabb<uint8_t>& remBox, Aabb<uint8_t>& changed);
+
+	/**
+	 * Merges regions of the same type that form a box with each other, but
+	 * only for regions touching the given area. Regions are only merged with
+	 * other regions in the same node.
+	 * @param area The block range to merge around.
+	 * @return The block range containing the area and all merged regions.
 	 */
-	void addRegions(std::vector<InternalRegion> addRegs);
+	Aabb<uint8_t> mergeAround(const Aabb<uint8_t>& area);
 
 	/**
 	 * Gets the number of regions stored in the tree.
 	 * @return The number of regions.
 	 */
-	size_t size() const ;
+	size_t size() const { return nodes.front().subtreeRegions; }
 
 	/**
 	 * Generates faces from the stored regions so the chunk can be rendered.
+	 * @param mode How to handle partially covered faces.
+	 * @param neighbors Used to cull faces on the edges of the tree.
 	 * @return A list of faces making up the mesh.
 	 */
-	std::vector<RegionFace> genQuads() const;
+	std::vector<RegionFace> genQuads(RegionTreeView::FaceMode mode = RegionTreeView::defaultFaceMode, const NeighborPlanes& neighbors = NeighborPlanes()) const {
+		return getView().genQuads(mode, neighbors);
+	}
+
+	/**
+	 * Generates only the visible faces which touch the given area.
+	 * See RegionTreeView::genQuads.
+	 * @param area The block range to generate faces for.
+	 * @param mode How to handle partially covered faces.
+	 * @param sourceFaces If not null, set to the whole faces touching the area.
+	 * @param neighbors Used to cull faces on the edges of the tree.
+	 * @return The faces touching the area.
+	 */
+	std::vector<RegionFace> genQuads(const Aabb<uint8_t>& area, RegionTreeView::FaceMode mode = RegionTreeView::defaultFaceMode,
+		std::vector<RegionFace>* sourceFaces = nullptr, const NeighborPlanes& neighbors = NeighborPlanes()) const {
+
+		return getView().genQuads(area, mode, sourceFaces, neighbors);
+	}
 
 	/**
 	 * Prints the number of regions for each node in a nicely formatted manner.
-	 * @param The number of indentations to put before the count.
 	 */
-	void printCounts(std::string idents = "") const;
+	void printCounts() const { getView().printCounts(); }
 
 	/**
 	 * Counts the number of nodes in the tree.
 	 * @return The number of nodes in the tree.
 	 */
-	size_t getNodeCount() const;
+	size_t getNodeCount() const { return nodes.size(); }
 
 	/**
 	 * Calculates the amount of memory used by the tree, its nodes, and the
 	 * regions stored in the nodes.
 	 * @return The total memory usage for the tree, in bytes.
 	 */
-	size_t getMemUsage() const;
+	size_t getMemUsage() const { return sizeof(RegionTree) + nodes.capacity() * sizeof(RegionNode) + regions.capacity() * sizeof(InternalRegion); }
 
 	/**
-	 * Returns whether this node is a leaf node. Leaf nodes
-	 * have no children.
-	 * @return Whether this node is a leaf.
+	 * Appends the tree to the given buffer, see RegionTreeView::serialize.
+	 * @param out The buffer to write to.
 	 */
-	bool isLeaf() const { return children.empty(); }
+	void serialize(std::vector<unsigned char>& out) const { getView().serialize(out); }
 
-private:
-	//Bounding box for this node. This is a block range, not a containing volume.
-	Aabb<uint8_t> box;
-	//Child nodes of this node.
-	std::vector<RegionTree> children;
-	//All regions stored in this node.
-	std::vector<InternalRegion> regions;
+	/**
+	 * Replaces the tree with one previously written by serialize. No
+	 * splitting or validation of the regions is done.
+	 * @param data The data to read from.
+	 * @param length The number of bytes available.
+	 * @return The number of bytes read.
+	 */
+	size_t deserialize(const unsigned char* data, size_t length);
+
+	/**
+	 * Finds the region containing the given block, see RegionTreeView::query.
+	 * @param point The block to look up.
+	 * @return The region containing the block, or nullptr if it is empty.
+	 */
+	const InternalRegion* query(const Aabb<uint8_t>::vec_t& point) const { return getView().query(point); }
+
+	/**
+	 * Calls a function for every region overlapping the given box.
+	 * @param area The block range to check.
+	 * @param fn The function to call, taking a const InternalRegion&.
+	 */
+	template<typename Func>
+	void forEachOverlapping(const Aabb<uint8_t>& area, Func fn) const { getView().forEachOverlapping(area, fn); }
 
 	/**
-	 * Fills the given block map with the regions stored in this tree.
-	 * @param map The map to fill.
+	 * Finds the first region hit by a ray, see RegionTreeView::raycast.
 	 */
-	void fillMap(BlockMap& map) const;
+	bool raycast(const glm::vec3& origin, const glm::vec3& dir, float minDist, float maxDist, RegionHit& hit) const { return getView().raycast(origin, dir, minDist, maxDist, hit); }
 
 	/**
-	 * Generates faces for this tree's regions. All the faces are external and
-	 * fully uncovered, provided the map is correct.
-	 * @param map The map to use for coverage lookups.
-	 * @param faces A vector to store the generated faces in.
+	 * Gets a view of the tree's arrays. The view is invalidated by any change
+	 * to the tree.
+	 * @return A view of the tree.
 	 */
-	void generateFaces(const BlockMap& map, std::vector<RegionFace>& faces) const;
+	RegionTreeView getView() const { return RegionTreeView(nodes.data(), nodes.size(), regions.data(), regions.size()); }
+
+	/**
+	 * Replaces this tree with a copy of the given flattened tree.
+	 * @param view The tree to copy, must have been validated.
+	 */
+	void assign(const RegionTreeView& view);
 
 	/**
 	 * Generates the faces for the provided region.
 	 * @param reg The region to generate faces for.
 	 * @return The generated faces.
 	 */
-	std::array<RegionFace, 6> genRegionFaces(const InternalRegion& region) const;
+	static std::array<RegionFace, 6> genRegionFaces(const InternalRegion& region);
+
+	/**
+	 * Returns whether the root node is a leaf node. Leaf nodes
+	 * have no children.
+	 * @return Whether the root is a leaf.
+	 */
+	bool isLeaf() const { return nodes.front().childCount == 0; }
+
+private:
+	//All nodes in the tree, starting with the root.
+	std::vector<RegionNode> nodes;
+	//All regions in the tree, with no gaps between the nodes' ranges.
+	std::vector<InternalRegion> regions;
+	//How nodes are split when they get too large.
+	SplitMode splitMode;
+
+	/**
+	 * Splits the given regions between a node and newly created children,
+	 * as in addRegions. The node must not have any regions or children.
+	 * @param node The index of the node to build.
+	 * @param addRegs The regions to add.
+	 */
+	void buildNode(size_t node, std::vector<InternalRegion> addRegs);
+
+	/**
+	 * Replaces the regions stored directly in a node, moving the ranges of
+	 * the other nodes as needed. Subtree counts are not updated.
+	 * @param node The index of the node.
+	 * @param newRegs The node's new regions.
+	 */
+	void setNodeRegions(size_t node, const std::vector<InternalRegion>& newRegs);
+
+	/**
+	 * Recalculates a node's subtree region count from its children.
+	 * @param node The index of the node.
+	 */
+	void updateCount(size_t node);
+
+	/**
+	 * Recursive part of removeBox.
+	 */
+	bool removeBox(size_t node, const Aabb<uint8_t>& remBox, Aabb<uint8_t>& changed);
+
+	/**
+	 * Recursive part of mergeAround.
+	 */
+	void mergeAround(size_t node, const Aabb<uint8_t>& touchBox, Aabb<uint8_t>& changed);
+
+	/**
+	 * Recursive part of deserialize.
+	 */
+	size_t deserializeNode(size_t node, const unsigned char* data, size_t length);
 };
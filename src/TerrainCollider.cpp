@@ -0,0 +1,91 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#include <cmath>
+#include <set>
+
+#include "TerrainCollider.hpp"
+#include "ScreenComponents.hpp"
+
+namespace {
+	/**
+	 * Creates a static object covering a region.
+	 * @param box The region's box, in world block coordinates.
+	 * @return The collider.
+	 */
+	std::shared_ptr<Object> createCollider(const Aabb<int64_t>& box) {
+		glm::vec3 halfSize = glm::vec3(box.max - box.min) / 2.0f;
+		glm::vec3 center = glm::vec3(box.min) + halfSize;
+
+		PhysicsInfo boxPhysics = {
+			.shape = PhysicsShape::BOX,
+			.box = Aabb<float>(-halfSize, halfSize),
+			//Blocks have z flipped compared to the world
+			.pos = {center.x, center.y, -center.z},
+			.mass = 0.0f,
+			.friction = 0.5f,
+			.disableRotation = true,
+		};
+
+		std::shared_ptr<Object> collider = std::make_shared<Object>();
+		collider->addComponent<PhysicsComponent>(std::make_shared<PhysicsObject>(boxPhysics));
+
+		return collider;
+	}
+}
+
+void TerrainCollider::update(Screen* screen) {
+	std::set<BoxKey> inRange;
+
+	for (size_t i = 0; i < bodies.size(); i++) {
+		std::shared_ptr<Object> body = bodies.at(i).lock();
+
+		if (!body) {
+			bodies.at(i) = bodies.back();
+			bodies.pop_back();
+			i--;
+			continue;
+		}
+
+		glm::vec3 pos = body->getPhysics()->getTranslation();
+		Pos_t blockPos((int64_t) std::floor(pos.x), (int64_t) std::floor(pos.y), (int64_t) std::floor(-pos.z));
+		Aabb<int64_t> area(blockPos - colliderRange, blockPos + colliderRange + 1);
+
+		chunkLoader->forEachOverlapping(area, [&](const Region& reg) {
+			BoxKey key = {reg.box.min.x, reg.box.min.y, reg.box.min.z, reg.box.max.x, reg.box.max.y, reg.box.max.z};
+			inRange.insert(key);
+
+			if (!colliders.count(key)) {
+				std::shared_ptr<Object> collider = createCollider(reg.box);
+				colliders.emplace(key, collider);
+				screen->addObject(collider);
+			}
+		});
+	}
+
+	//Edited regions get new boxes, so their old colliders end up here too
+	for (auto collider = colliders.begin(); collider != colliders.end();) {
+		if (!inRange.count(collider->first)) {
+			screen->removeObject(collider->second);
+			collider = colliders.erase(collider);
+		}
+		else {
+			collider++;
+		}
+	}
+}
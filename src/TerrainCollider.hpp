@@ -0,0 +1,69 @@
+/******************************************************************************
+ * Voxex - An experiment with sparse voxel terrain
+ * Copyright (C) 2020
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "Components/UpdateComponent.hpp"
+#include "ChunkLoader.hpp"
+
+/**
+ * Gives physics objects terrain to collide with, using static boxes made
+ * from the regions near them. Collision doesn't depend on chunk meshes,
+ * so their vertices can be in any format.
+ */
+class TerrainCollider : public UpdateComponent {
+public:
+	//How far from each body regions get colliders, in blocks.
+	static constexpr int64_t colliderRange = 4;
+
+	/**
+	 * Creates a terrain collider.
+	 * @param loader The world's chunk loader.
+	 */
+	TerrainCollider(std::shared_ptr<ChunkLoader> loader) : chunkLoader(loader) {}
+
+	/**
+	 * Makes terrain around an object collidable. The object is dropped
+	 * once it no longer exists.
+	 * @param body The object, which must have physics.
+	 */
+	void addBody(std::shared_ptr<Object> body) { bodies.push_back(body); }
+
+	/**
+	 * Adds colliders for regions which came into range of a body, and
+	 * removes those which left the range of every body.
+	 * @param screen The parent screen.
+	 */
+	void update(Screen* screen) override;
+
+private:
+	//A region's box, as its minimum then maximum coordinates.
+	typedef std::array<int64_t, 6> BoxKey;
+
+	//The chunk loader, used for finding regions.
+	std::shared_ptr<ChunkLoader> chunkLoader;
+	//Objects which collide with the terrain.
+	std::vector<std::weak_ptr<Object>> bodies;
+	//Static objects for the regions in range of a body, by region box.
+	std::map<BoxKey, std::shared_ptr<Object>> colliders;
+};
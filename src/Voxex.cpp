@@ -30,6 +30,7 @@
 #include "Mobs/BoxMonster.hpp"
 #include "FollowCamera.hpp"
 #include "MouseHandler.hpp"
+#include "TerrainCollider.hpp"
 
 namespace {
 #pragma GCC diagnostic push
@@ -62,16 +63,19 @@ namespace {
 
 	struct ShaderPaths {
 		ShaderNames chunk;
+		ShaderNames chunkPacked;
 		ShaderNames basic;
 	};
 
 	const ShaderPaths glShaders = {
 		{"shaders/glsl/chunk.vert", "shaders/glsl/chunk.frag"},
+		{"shaders/glsl/chunkPacked.vert", "shaders/glsl/chunk.frag"},
 		{"shaders/glsl/generic.vert", "shaders/glsl/basic.frag"}
 	};
 
 	const ShaderPaths vkShaders = {
 		{"shaders/spirv/chunk.vert.spv", "shaders/spirv/chunk.frag.spv"},
+		{"shaders/spirv/chunkPacked.vert.spv", "shaders/spirv/chunk.frag.spv"},
 		{"shaders/spirv/generic.vert.spv", "shaders/spirv/basic.frag.spv"}
 	};
 
@@ -80,18 +84,23 @@ namespace {
 }
 
 void Voxex::createRenderObjects(RenderInitializer& renderInit) {
-	const size_t chunkBufferSize = 1'073'741'824;
-	const size_t indexSize = (4 * chunkBufferSize) / 6;
-
-	renderInit.createBuffer(CHUNK_VERTEX_BUFFER, chunkBufferSize, BufferType::VERTEX, BufferStorage::DEVICE);
-	renderInit.createBuffer(CHUNK_INDEX_BUFFER, indexSize, BufferType::INDEX, BufferStorage::DEVICE);
+	renderInit.createBuffer(CHUNK_VERTEX_BUFFER, CHUNK_VERTEX_BUFFER_SIZE, BufferType::VERTEX, BufferStorage::DEVICE);
+	renderInit.createBuffer(CHUNK_INDEX_BUFFER, CHUNK_INDEX_BUFFER_SIZE, BufferType::INDEX, BufferStorage::DEVICE);
 	renderInit.createBuffer(GENERIC_VERTEX_BUFFER, 1'048'576, BufferType::VERTEX, BufferStorage::DEVICE);
 	renderInit.createBuffer(GENERIC_INDEX_BUFFER, 1'048'576, BufferType::INDEX, BufferStorage::DEVICE);
 
-	renderInit.addVertexFormat(CHUNK_FORMAT, VertexFormat({
-		{VERTEX_ELEMENT_POSITION, VertexFormat::ElementType::VEC3},
-		{VERTEX_ELEMENT_PACKED_NORM_COLOR, VertexFormat::ElementType::UINT32}
-	}));
+	if (PACKED_CHUNK_VERTICES) {
+		renderInit.addVertexFormat(CHUNK_FORMAT, VertexFormat({
+			{VERTEX_ELEMENT_PACKED_POS_NORM, VertexFormat::ElementType::UINT32},
+			{VERTEX_ELEMENT_BLOCK_TYPE, VertexFormat::ElementType::UINT32}
+		}));
+	}
+	else {
+		renderInit.addVertexFormat(CHUNK_FORMAT, VertexFormat({
+			{VERTEX_ELEMENT_POSITION, VertexFormat::ElementType::VEC3},
+			{VERTEX_ELEMENT_PACKED_NORM_COLOR, VertexFormat::ElementType::UINT32}
+		}));
+	}
 
 	renderInit.addVertexFormat(GENERIC_FORMAT, VertexFormat({
 		{VERTEX_ELEMENT_POSITION, VertexFormat::ElementType::VEC3},
@@ -158,9 +167,11 @@ void Voxex::loadModels(ModelLoader& loader) {
 }
 
 void Voxex::loadShaders(std::shared_ptr<ShaderLoader> loader) {
+	const ShaderNames& chunkShader = PACKED_CHUNK_VERTICES ? shaderFiles->chunkPacked : shaderFiles->chunk;
+
 	ShaderInfo chunkInfo = {
-		.vertex = shaderFiles->chunk.vertex,
-		.fragment = shaderFiles->chunk.fragment,
+		.vertex = chunkShader.vertex,
+		.fragment = chunkShader.fragment,
 		.pass = RenderPass::OPAQUE,
 		.format = CHUNK_FORMAT,
 		.uniformSets = {SCREEN_SET, CHUNK_SET},
@@ -193,12 +204,21 @@ void Voxex::loadScreens(DisplayEngine& display) {
 
 	world->addObject(chunkLoader);
 
+	std::shared_ptr<Object> terrainCollider = std::make_shared<Object>();
+	terrainCollider->addComponent<TerrainCollider>(chunkLoader->getComponent<ChunkLoader>());
+
+	world->addObject(terrainCollider);
+
 	for (size_t i = 0; i < 10; i++) {
-		world->addObject(BoxMonster::create({0.0, 300.0 + i + 0.5, 0.0}));
+		std::shared_ptr<Object> monster = BoxMonster::create({0.0, 300.0 + i + 0.5, 0.0}, chunkLoader->getComponent<ChunkLoader>());
+		terrainCollider->getComponent<TerrainCollider>()->addBody(monster);
+
+		world->addObject(monster);
 	}
 
-	std::shared_ptr<Object> player = Adventurer::create();
+	std::shared_ptr<Object> player = Adventurer::create(chunkLoader->getComponent<ChunkLoader>());
 	chunkLoader->getComponent<ChunkLoader>()->addLoader(player, 1, 3);
+	terrainCollider->getComponent<TerrainCollider>()->addBody(player);
 
 	world->addObject(player);
 
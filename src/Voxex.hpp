@@ -23,6 +23,18 @@
 class Voxex : public GameInterface {
 public:
 	static constexpr bool USE_VULKAN = true;
+	//Whether chunk meshes use 8 byte vertices with integer positions packed
+	//together with the normal, instead of 16 byte vertices with float positions.
+	//Terrain collision is built from the regions rather than the meshes, so
+	//either format works.
+	static constexpr bool PACKED_CHUNK_VERTICES = true;
+
+	//Size of the chunk vertex buffer. Packed vertices are half the size, so
+	//the same number of faces fit in half the space.
+	static constexpr size_t CHUNK_VERTEX_BUFFER_SIZE = PACKED_CHUNK_VERTICES ? 536'870'912 : 1'073'741'824;
+	//Size of the chunk index buffer. Every quad uses 4 vertices and 6 indices,
+	//so only as much index space as the vertex buffer can use is reserved.
+	static constexpr size_t CHUNK_INDEX_BUFFER_SIZE = CHUNK_VERTEX_BUFFER_SIZE / (4 * (PACKED_CHUNK_VERTICES ? 8 : 16)) * 6 * sizeof(uint32_t);
 
 	void createRenderObjects(RenderInitializer& renderInit) override;
 	void loadTextures(std::shared_ptr<TextureLoader> loader) override;